@@ -7,11 +7,14 @@ import (
 	// #include <stdlib.h>
 	// #include "wifi-scanner.h"
 	// #include "packet-sniffer.h"
+	// #include "interface-inventory.h"
 	"C"
 	"unsafe"
 
 	"context"
 	"fmt"
+	"os"
+	"strconv"
 
 	"github.com/wailsapp/wails/v2/pkg/runtime"
 )
@@ -26,6 +29,64 @@ type App struct {
 	ctx context.Context
 }
 
+// Event payloads sent to the frontend. Typed structs instead of maps, so
+// emitting an event doesn't build a new map every time.
+
+type NetworkEvent struct {
+	SSID           string `json:"ssid"`
+	BSSID          string `json:"bssid"`
+	Channel        int    `json:"channel"`
+	Frequency      int    `json:"frequency"`
+	SignalStrength int    `json:"signalStrength"`
+}
+
+type PayloadMatch struct {
+	Pattern string `json:"pattern"`
+	Offset  uint32 `json:"offset"`
+}
+
+// PacketEvent carries the first few payload matches in Matches, and the
+// number of all of them in MatchCount.
+type PacketEvent struct {
+	SrcMac     string         `json:"srcMac"`
+	DestMac    string         `json:"destMac"`
+	EthType    string         `json:"ethType"`
+	SrcIPv4    string         `json:"srcIPv4"`
+	DestIPv4   string         `json:"destIPv4"`
+	SrcIPv6    string         `json:"srcIPv6"`
+	DestIPv6   string         `json:"destIPv6"`
+	SrcPort    int            `json:"srcPort"`
+	DestPort   int            `json:"destPort"`
+	Payload    string         `json:"payload"`
+	Matches    []PayloadMatch `json:"matches"`
+	MatchCount int            `json:"matchCount"`
+}
+
+// SubsystemMemory is the memory use of one part of a capture session.
+type SubsystemMemory struct {
+	Used     uint64 `json:"used"`
+	Reserved uint64 `json:"reserved"`
+	Refused  uint64 `json:"refused"`
+}
+
+// InterfaceDetails is what the inventory knows about one interface.
+type InterfaceDetails struct {
+	Name        string `json:"name"`
+	CanMonitor  bool   `json:"canMonitor"`
+	MonitorMode bool   `json:"monitorMode"`
+	Driver      string `json:"driver"`
+}
+
+// ARPHRD_IEEE80211_RADIOTAP, the link type of an interface in monitor mode.
+const linkTypeRadiotap = 803
+
+type MemoryUsage struct {
+	Budget     uint64          `json:"budget"`
+	Parser     SubsystemMemory `json:"parser"`
+	Aggregates SubsystemMemory `json:"aggregates"`
+	Buffers    SubsystemMemory `json:"buffers"`
+}
+
 // NewApp creates a new App application struct
 func NewApp() *App {
 	a := &App{}
@@ -37,16 +98,31 @@ func NewApp() *App {
 // so we can call the runtime methods
 func (a *App) startup(ctx context.Context) {
 	a.ctx = ctx
+
+	// Sensors with little RAM can lower the capture memory budget at launch.
+	if value := os.Getenv("WIFI_ANALYZER_MEMORY_BUDGET_MB"); value != "" {
+		if megabytes, err := strconv.Atoi(value); err != nil || !a.SetMemoryBudget(megabytes) {
+			fmt.Println("Ignoring invalid WIFI_ANALYZER_MEMORY_BUDGET_MB:", value)
+		}
+	}
+
+	// Probe the interfaces in the background so the first GetInterfaces
+	// call doesn't have to wait for it.
+	go C.interface_inventory_start()
 }
 
+// GetInterfaces returns the interfaces from the cached inventory, so it is
+// cheap to call. The frontend is told about changes via "interfaces:changed".
 func (a *App) GetInterfaces(monitor bool) []string {
 	var interfaces **C.char
 	var length C.int
 
 	if monitor {
 		C.get_monitor_interfaces(&interfaces, &length)
+		defer C.free_monitor_interfaces(interfaces, length)
 	} else {
 		C.get_all_interfaces(&interfaces, &length)
+		defer C.free_all_interfaces(interfaces, length)
 	}
 	println("Number of interfaces found:", length)
 
@@ -58,6 +134,41 @@ func (a *App) GetInterfaces(monitor bool) []string {
 	return interfaceList
 }
 
+// GetInterfaceDetails returns every interface in the inventory with its
+// monitor mode support and driver. Like GetInterfaces it is cheap to call.
+func (a *App) GetInterfaceDetails() []InterfaceDetails {
+	var entries *C.struct_interface_entry
+	var length C.int
+
+	if C.interface_inventory_entries(&entries, &length) != 0 {
+		return nil
+	}
+	defer C.free(unsafe.Pointer(entries))
+
+	details := make([]InterfaceDetails, 0, int(length))
+	for _, e := range unsafe.Slice(entries, length) {
+		details = append(details, InterfaceDetails{
+			Name:        C.GoString(&e.name[0]),
+			CanMonitor:  e.can_monitor != 0,
+			MonitorMode: e.link_type == linkTypeRadiotap,
+			Driver:      C.GoString(&e.driver[0]),
+		})
+	}
+	return details
+}
+
+// on_interfaces_changed is called from C's netlink listener thread whenever
+// an interface is added, removed or renamed.
+
+//export on_interfaces_changed
+func on_interfaces_changed() {
+	if appInstance == nil || appInstance.ctx == nil {
+		return
+	}
+
+	runtime.EventsEmit(appInstance.ctx, "interfaces:changed")
+}
+
 // StartMonitoring begins capturing beacons on the given interface.
 // The capture runs in a background goroutine so the UI is never blocked.
 func (a *App) StartMonitoring(interfaceName string) string {
@@ -91,12 +202,12 @@ func on_network_found(ssid *C.char, bssid *C.char, channel C.int, frequency C.in
 		return
 	}
 
-	runtime.EventsEmit(appInstance.ctx, "network:found", map[string]any{
-		"ssid":           C.GoString(ssid),
-		"bssid":          C.GoString(bssid),
-		"channel":        int(channel),
-		"frequency":      int(frequency),
-		"signalStrength": int(signalStrength),
+	runtime.EventsEmit(appInstance.ctx, "network:found", NetworkEvent{
+		SSID:           C.GoString(ssid),
+		BSSID:          C.GoString(bssid),
+		Channel:        int(channel),
+		Frequency:      int(frequency),
+		SignalStrength: int(signalStrength),
 	})
 }
 
@@ -124,6 +235,42 @@ func (a *App) StopPacketCapture() {
 	C.stop_packet_capture()
 }
 
+// SetPayloadPatterns replaces the list of strings that captured TCP payloads
+// are matched against. It can be called while a capture is running.
+// An empty list turns matching off, so every payload is shown again.
+func (a *App) SetPayloadPatterns(patterns []string) bool {
+	count := len(patterns)
+	cPatterns := (**C.char)(C.malloc(C.size_t(max(count, 1)) * C.size_t(unsafe.Sizeof(uintptr(0)))))
+	cLengths := (*C.int)(C.malloc(C.size_t(max(count, 1)) * C.size_t(unsafe.Sizeof(C.int(0)))))
+	defer C.free(unsafe.Pointer(cPatterns))
+	defer C.free(unsafe.Pointer(cLengths))
+
+	patternSlice := unsafe.Slice(cPatterns, max(count, 1))
+	lengthSlice := unsafe.Slice(cLengths, max(count, 1))
+	for i, pattern := range patterns {
+		patternSlice[i] = C.CString(pattern)
+		lengthSlice[i] = C.int(len(pattern))
+		defer C.free(unsafe.Pointer(patternSlice[i]))
+	}
+
+	return C.set_payload_patterns(cPatterns, cLengths, C.int(count)) == 0
+}
+
+// Matches found in the packet that is currently being reported. C calls
+// on_payload_match and then on_packet_captured from the capture thread,
+// so no locking is needed.
+var pendingMatches []PayloadMatch
+
+// on_payload_match is called from C for every payload pattern match.
+
+//export on_payload_match
+func on_payload_match(pattern *C.char, patternLength C.int, offset C.uint) {
+	pendingMatches = append(pendingMatches, PayloadMatch{
+		Pattern: C.GoStringN(pattern, patternLength),
+		Offset:  uint32(offset),
+	})
+}
+
 // on_packet_captured is called from C's packet_handler for every captured packet.
 // It emits a Wails event so the Vue frontend can react in real time.
 
@@ -132,27 +279,70 @@ func on_packet_captured(srcMac *C.char, destMac *C.char, ethType *C.char,
 	srcIPv4 *C.char, destIPv4 *C.char,
 	srcIPv6 *C.char, destIPv6 *C.char,
 	srcPort C.int, destPort C.int,
-	payload *C.char, payloadLength C.int) {
+	payload *C.char, payloadLength C.int, matchCount C.int) {
+
+	matches := pendingMatches
+	pendingMatches = nil
 
 	if appInstance == nil || appInstance.ctx == nil {
 		return
 	}
 
 	payloadString := ""
-	for i := C.int(0); i < payloadLength; i++ {
-		payloadString += string(*(*byte)(unsafe.Pointer(uintptr(unsafe.Pointer(payload)) + uintptr(i))))
+	if payload != nil && payloadLength > 0 {
+		payloadString = C.GoStringN(payload, payloadLength)
 	}
 
-	runtime.EventsEmit(appInstance.ctx, "packet:captured", map[string]any{
-		"srcMac":   C.GoString(srcMac),
-		"destMac":  C.GoString(destMac),
-		"ethType":  C.GoString(ethType),
-		"srcIPv4":  C.GoString(srcIPv4),
-		"destIPv4": C.GoString(destIPv4),
-		"srcIPv6":  C.GoString(srcIPv6),
-		"destIPv6": C.GoString(destIPv6),
-		"srcPort":  int(srcPort),
-		"destPort": int(destPort),
-		"payload":  payloadString,
+	runtime.EventsEmit(appInstance.ctx, "packet:captured", PacketEvent{
+		SrcMac:     C.GoString(srcMac),
+		DestMac:    C.GoString(destMac),
+		EthType:    C.GoString(ethType),
+		SrcIPv4:    C.GoString(srcIPv4),
+		DestIPv4:   C.GoString(destIPv4),
+		SrcIPv6:    C.GoString(srcIPv6),
+		DestIPv6:   C.GoString(destIPv6),
+		SrcPort:    int(srcPort),
+		DestPort:   int(destPort),
+		Payload:    payloadString,
+		Matches:    matches,
+		MatchCount: int(matchCount),
 	})
 }
+
+// SetMemoryBudget sets the most memory a capture may use, in megabytes.
+// It applies to captures started afterwards; 0 means no limit. A negative
+// budget is refused and false returned.
+func (a *App) SetMemoryBudget(megabytes int) bool {
+	if megabytes < 0 {
+		return false
+	}
+	C.set_memory_budget(C.size_t(megabytes) * 1024 * 1024)
+	return true
+}
+
+// GetMemoryUsage reports the memory used by the running packet capture
+// (or beacon capture, if packetCapture is false), per subsystem.
+func (a *App) GetMemoryUsage(packetCapture bool) MemoryUsage {
+	var usage C.struct_memory_usage
+
+	if packetCapture {
+		C.get_packet_capture_memory_usage(&usage)
+	} else {
+		C.get_capture_memory_usage(&usage)
+	}
+
+	subsystem := func(i C.int) SubsystemMemory {
+		return SubsystemMemory{
+			Used:     uint64(usage.used[i]),
+			Reserved: uint64(usage.reserved[i]),
+			Refused:  uint64(usage.refused[i]),
+		}
+	}
+
+	return MemoryUsage{
+		Budget:     uint64(usage.budget),
+		Parser:     subsystem(C.MEMORY_PARSER),
+		Aggregates: subsystem(C.MEMORY_AGGREGATES),
+		Buffers:    subsystem(C.MEMORY_BUFFERS),
+	}
+}
@@ -1,8 +1,17 @@
 // Cynhyrchwyd y ffeil hon yn awtomatig. PEIDIWCH Â MODIWL
 // This file is automatically generated. DO NOT EDIT
+import {main} from '../models';
+
+export function GetInterfaceDetails():Promise<Array<main.InterfaceDetails>>;
 
 export function GetInterfaces(arg1:boolean):Promise<Array<string>>;
 
+export function GetMemoryUsage(arg1:boolean):Promise<main.MemoryUsage>;
+
+export function SetMemoryBudget(arg1:number):Promise<boolean>;
+
+export function SetPayloadPatterns(arg1:Array<string>):Promise<boolean>;
+
 export function StartMonitoring(arg1:string):Promise<string>;
 
 export function StartPacketCapture(arg1:string):Promise<string>;
@@ -2,10 +2,26 @@
 // Cynhyrchwyd y ffeil hon yn awtomatig. PEIDIWCH Â MODIWL
 // This file is automatically generated. DO NOT EDIT
 
+export function GetInterfaceDetails() {
+  return window['go']['main']['App']['GetInterfaceDetails']();
+}
+
 export function GetInterfaces(arg1) {
   return window['go']['main']['App']['GetInterfaces'](arg1);
 }
 
+export function GetMemoryUsage(arg1) {
+  return window['go']['main']['App']['GetMemoryUsage'](arg1);
+}
+
+export function SetMemoryBudget(arg1) {
+  return window['go']['main']['App']['SetMemoryBudget'](arg1);
+}
+
+export function SetPayloadPatterns(arg1) {
+  return window['go']['main']['App']['SetPayloadPatterns'](arg1);
+}
+
 export function StartMonitoring(arg1) {
   return window['go']['main']['App']['StartMonitoring'](arg1);
 }
@@ -0,0 +1,75 @@
+export namespace main {
+	
+	export class InterfaceDetails {
+	    name: string;
+	    canMonitor: boolean;
+	    monitorMode: boolean;
+	    driver: string;
+	
+	    static createFrom(source: any = {}) {
+	        return new InterfaceDetails(source);
+	    }
+	
+	    constructor(source: any = {}) {
+	        if ('string' === typeof source) source = JSON.parse(source);
+	        this.name = source["name"];
+	        this.canMonitor = source["canMonitor"];
+	        this.monitorMode = source["monitorMode"];
+	        this.driver = source["driver"];
+	    }
+	}
+	export class SubsystemMemory {
+	    used: number;
+	    reserved: number;
+	    refused: number;
+	
+	    static createFrom(source: any = {}) {
+	        return new SubsystemMemory(source);
+	    }
+	
+	    constructor(source: any = {}) {
+	        if ('string' === typeof source) source = JSON.parse(source);
+	        this.used = source["used"];
+	        this.reserved = source["reserved"];
+	        this.refused = source["refused"];
+	    }
+	}
+	export class MemoryUsage {
+	    budget: number;
+	    parser: SubsystemMemory;
+	    aggregates: SubsystemMemory;
+	    buffers: SubsystemMemory;
+	
+	    static createFrom(source: any = {}) {
+	        return new MemoryUsage(source);
+	    }
+	
+	    constructor(source: any = {}) {
+	        if ('string' === typeof source) source = JSON.parse(source);
+	        this.budget = source["budget"];
+	        this.parser = this.convertValues(source["parser"], SubsystemMemory);
+	        this.aggregates = this.convertValues(source["aggregates"], SubsystemMemory);
+	        this.buffers = this.convertValues(source["buffers"], SubsystemMemory);
+	    }
+	
+		convertValues(a: any, classs: any, asMap: boolean = false): any {
+		    if (!a) {
+		        return a;
+		    }
+		    if (a.slice && a.map) {
+		        return (a as any[]).map(elem => this.convertValues(elem, classs));
+		    } else if ("object" === typeof a) {
+		        if (asMap) {
+		            for (const key of Object.keys(a)) {
+		                a[key] = new classs(a[key]);
+		            }
+		            return a;
+		        }
+		        return new classs(a);
+		    }
+		    return a;
+		}
+	}
+
+}
+
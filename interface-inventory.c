@@ -0,0 +1,332 @@
+#include <pcap/pcap.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include "interface-inventory.h"
+
+/* All interfaces found by pcap, probed once and then kept up to date by
+   the netlink listener, and the result of the last full probe. Guarded by
+   inventory_lock. */
+static pthread_mutex_t inventory_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct interface_entry *inventory = NULL;
+static int inventory_count = 0;
+static int inventory_status = 0;
+
+static pthread_once_t inventory_once = PTHREAD_ONCE_INIT;
+static int netlink_fd = -1;
+
+static int read_link_type(const char *name) {
+  char path[64 + IF_NAMESIZE];
+  snprintf(path, sizeof(path), "/sys/class/net/%s/type", name);
+
+  FILE *f = fopen(path, "r");
+  if (f == NULL) return -1;
+  int link_type = -1;
+  if (fscanf(f, "%d", &link_type) != 1) link_type = -1;
+  fclose(f);
+  return link_type;
+}
+
+static void read_driver(const char *name, char *driver, size_t size) {
+  char path[64 + IF_NAMESIZE];
+  char target[256];
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver", name);
+
+  ssize_t len = readlink(path, target, sizeof(target) - 1);
+  if (len <= 0) return;
+  target[len] = '\0';
+
+  char *base = strrchr(target, '/');
+  base = base != NULL ? base + 1 : target;
+  size_t copy = strlen(base) < size - 1 ? strlen(base) : size - 1;
+  memcpy(driver, base, copy);
+  driver[copy] = '\0';
+}
+
+/*
+  * Fill in everything we want to know about one interface. This opens a
+  * pcap handle, so it should not be called with the inventory locked.
+*/
+static void probe_interface(const char *name, struct interface_entry *entry) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+
+  memset(entry, 0, sizeof(struct interface_entry));
+  snprintf(entry->name, sizeof(entry->name), "%s", name);
+  entry->index = if_nametoindex(name);
+  entry->link_type = read_link_type(name);
+  read_driver(name, entry->driver, sizeof(entry->driver));
+
+  pcap_t *dev = pcap_create(name, errbuf);
+  if (dev != NULL) {
+    entry->can_monitor = pcap_can_set_rfmon(dev) == 1;
+    pcap_close(dev);
+  }
+}
+
+static int probe_failed(void) {
+  pthread_mutex_lock(&inventory_lock);
+  inventory_status = 2;
+  pthread_mutex_unlock(&inventory_lock);
+  return 2;
+}
+
+/*
+  * Rebuild the whole inventory from pcap_findalldevs(), and record in
+  * inventory_status whether that worked.
+  * @return: 0 on success, 2 on error
+*/
+static int probe_all(void) {
+  char errbuf[PCAP_ERRBUF_SIZE];
+  pcap_if_t *devs;
+
+  if (pcap_findalldevs(&devs, errbuf) != 0) {
+    fprintf(stderr, "Error getting interfaces: %s\n", errbuf);
+    return probe_failed();
+  }
+
+  int count = 0;
+  for (pcap_if_t *d = devs; d != NULL; d = d->next) count++;
+
+  struct interface_entry *entries = malloc((count > 0 ? count : 1) * sizeof(struct interface_entry));
+  if (entries == NULL) {
+    pcap_freealldevs(devs);
+    return probe_failed();
+  }
+
+  int i = 0;
+  for (pcap_if_t *d = devs; d != NULL; d = d->next) {
+    probe_interface(d->name, &entries[i++]);
+  }
+  pcap_freealldevs(devs);
+
+  pthread_mutex_lock(&inventory_lock);
+  free(inventory);
+  inventory = entries;
+  inventory_count = count;
+  inventory_status = 0;
+  pthread_mutex_unlock(&inventory_lock);
+  return 0;
+}
+
+/* Must be called with the inventory locked. */
+static int find_by_index(unsigned int index) {
+  for (int i = 0; i < inventory_count; i++) {
+    if (inventory[i].index == index) return i;
+  }
+  return -1;
+}
+
+/* Must be called with the inventory locked. */
+static void remove_at(int i) {
+  memmove(&inventory[i], &inventory[i + 1],
+          (inventory_count - i - 1) * sizeof(struct interface_entry));
+  inventory_count--;
+}
+
+/*
+  * Handle RTM_NEWLINK. The kernel also sends it for plain state changes
+  * (up/down, carrier), so a known interface is only probed again when its
+  * name or link type changed, e.g. when it was switched to monitor mode.
+  * @param link_type: ifi_type from the message, an ARPHRD_* value.
+  * @return: 1 if the inventory changed, 0 otherwise
+*/
+static int add_interface(unsigned int index, const char *name, int link_type) {
+  pthread_mutex_lock(&inventory_lock);
+  int i = find_by_index(index);
+  if (i >= 0 && strcmp(inventory[i].name, name) == 0 && inventory[i].link_type == link_type) {
+    pthread_mutex_unlock(&inventory_lock);
+    return 0;
+  }
+  pthread_mutex_unlock(&inventory_lock);
+
+  struct interface_entry entry;
+  probe_interface(name, &entry);
+  entry.index = index;
+  entry.link_type = link_type; // sysfs may not have caught up yet
+
+  pthread_mutex_lock(&inventory_lock);
+  i = find_by_index(index);
+  if (i >= 0) {
+    inventory[i] = entry; // renamed or changed mode
+  } else {
+    struct interface_entry *grown = realloc(inventory, (inventory_count + 1) * sizeof(struct interface_entry));
+    if (grown == NULL) {
+      pthread_mutex_unlock(&inventory_lock);
+      return 0;
+    }
+    inventory = grown;
+    inventory[inventory_count++] = entry;
+  }
+  pthread_mutex_unlock(&inventory_lock);
+  return 1;
+}
+
+/*
+  * Handle RTM_DELLINK.
+  * @return: 1 if the inventory changed, 0 otherwise
+*/
+static int remove_interface(unsigned int index) {
+  pthread_mutex_lock(&inventory_lock);
+  int i = find_by_index(index);
+  if (i >= 0) remove_at(i);
+  pthread_mutex_unlock(&inventory_lock);
+  return i >= 0;
+}
+
+static void *netlink_listener(void *arg) {
+  (void)arg;
+  char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+  for (;;) {
+    ssize_t len = recv(netlink_fd, buf, sizeof(buf), 0);
+    if (len < 0) {
+      if (errno == EINTR) continue;
+      if (errno == ENOBUFS) {
+        // Some notifications were lost, so start over from scratch.
+        if (probe_all() == 0) on_interfaces_changed();
+        continue;
+      }
+      fprintf(stderr, "Netlink listener stopped: %s\n", strerror(errno));
+      break;
+    }
+
+    int changed = 0;
+    int remaining = (int)len;
+    for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, remaining);
+         nlh = NLMSG_NEXT(nlh, remaining)) {
+      if (nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK) continue;
+
+      struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+      if (nlh->nlmsg_type == RTM_DELLINK) {
+        changed |= remove_interface(ifi->ifi_index);
+        continue;
+      }
+
+      int attr_len = IFLA_PAYLOAD(nlh);
+      for (struct rtattr *attr = IFLA_RTA(ifi); RTA_OK(attr, attr_len);
+           attr = RTA_NEXT(attr, attr_len)) {
+        if (attr->rta_type == IFLA_IFNAME) {
+          changed |= add_interface(ifi->ifi_index, (const char *)RTA_DATA(attr), ifi->ifi_type);
+          break;
+        }
+      }
+    }
+
+    if (changed) on_interfaces_changed();
+  }
+
+  close(netlink_fd);
+  netlink_fd = -1;
+  return NULL;
+}
+
+static void inventory_init(void) {
+  // Subscribe before probing so no interface can slip in between.
+  netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (netlink_fd >= 0) {
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_LINK;
+    if (bind(netlink_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(netlink_fd);
+      netlink_fd = -1;
+    }
+  }
+  if (netlink_fd < 0) {
+    fprintf(stderr, "Couldn't open netlink socket, interface changes won't be noticed: %s\n",
+            strerror(errno));
+  }
+
+  probe_all();
+
+  if (netlink_fd >= 0) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, netlink_listener, NULL) == 0) {
+      pthread_detach(thread);
+    } else {
+      close(netlink_fd);
+      netlink_fd = -1;
+    }
+  }
+}
+
+/*
+  * Probe all interfaces and start listening for changes. Only the first
+  * call does any work, unless probing failed, in which case it is retried.
+  * @return: 0 on success, 2 on error
+*/
+int interface_inventory_start(void) {
+  pthread_once(&inventory_once, inventory_init);
+
+  pthread_mutex_lock(&inventory_lock);
+  int status = inventory_status;
+  pthread_mutex_unlock(&inventory_lock);
+
+  // The last full probe failed, try again. Concurrent retries are harmless:
+  // each one swaps in a complete list under the lock.
+  if (status != 0) status = probe_all();
+  return status;
+}
+
+/*
+  * Get the names of the known interfaces.
+  * @param interfaces: A pointer to an array of strings to store the interface names.
+  * @param count: A pointer to an integer to store the number of interfaces found.
+  * @param monitor_only: If 1, only list interfaces that support monitor mode.
+  * @return: 0 on success, 2 on error
+*/
+int interface_inventory_names(char **interfaces[], int *count, int monitor_only) {
+  *count = 0;
+  *interfaces = NULL;
+  if (interface_inventory_start() != 0) return 2;
+
+  pthread_mutex_lock(&inventory_lock);
+  int total = 0;
+  for (int i = 0; i < inventory_count; i++) {
+    if (!monitor_only || inventory[i].can_monitor) total++;
+  }
+
+  *interfaces = (char **)malloc((total > 0 ? total : 1) * sizeof(char *));
+  if (*interfaces == NULL) {
+    pthread_mutex_unlock(&inventory_lock);
+    return 2;
+  }
+  for (int i = 0; i < inventory_count; i++) {
+    if (monitor_only && !inventory[i].can_monitor) continue;
+    (*interfaces)[*count] = (char *)malloc((strlen(inventory[i].name) + 1) * sizeof(char));
+    if ((*interfaces)[*count] == NULL) break;
+    strcpy((*interfaces)[*count], inventory[i].name);
+    (*count)++;
+  }
+  pthread_mutex_unlock(&inventory_lock);
+  return 0;
+}
+
+/*
+  * Get a copy of the full inventory. Free it with free().
+  * @param entries: A pointer to store the array of entries.
+  * @param count: A pointer to an integer to store the number of entries.
+  * @return: 0 on success, 2 on error
+*/
+int interface_inventory_entries(struct interface_entry **entries, int *count) {
+  *count = 0;
+  *entries = NULL;
+  if (interface_inventory_start() != 0) return 2;
+
+  pthread_mutex_lock(&inventory_lock);
+  *entries = malloc((inventory_count > 0 ? inventory_count : 1) * sizeof(struct interface_entry));
+  if (*entries != NULL) {
+    memcpy(*entries, inventory, inventory_count * sizeof(struct interface_entry));
+    *count = inventory_count;
+  }
+  pthread_mutex_unlock(&inventory_lock);
+  return *entries != NULL ? 0 : 2;
+}
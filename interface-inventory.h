@@ -0,0 +1,23 @@
+#ifndef INTERFACE_INVENTORY_H
+#define INTERFACE_INVENTORY_H
+
+#include <net/if.h>
+
+struct interface_entry {
+  char name[IF_NAMESIZE];
+  unsigned int index; // kernel interface index, 0 for pseudo devices like "any"
+  int can_monitor; // 1 if pcap_can_set_rfmon() said yes
+  int link_type; // ARPHRD_* value from sysfs, -1 if unknown
+  char driver[32]; // kernel driver name, empty if unknown
+};
+
+int interface_inventory_start(void);
+int interface_inventory_names(char **interfaces[], int *count, int monitor_only);
+int interface_inventory_entries(struct interface_entry **entries, int *count);
+
+/* Callback implemented in Go (via //export) when built with cgo,
+   or in C for standalone builds. Called from the listener thread
+   whenever an interface appears or disappears. */
+extern void on_interfaces_changed(void);
+
+#endif /* INTERFACE_INVENTORY_H */
@@ -1,9 +1,16 @@
 #include <pcap/pcap.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "packet-sniffer.h"
+#include "interface-inventory.h"
+#include "payload-matcher.h"
+#include "session-arena.h"
+#include "tcp-reassembly.h"
 
 struct ethernet_header {
   u_int8_t dest[6];
@@ -14,20 +21,43 @@ struct ethernet_header {
 struct ipv6_info {
   char src_ip[40];
   char dest_ip[40];
+  u_int8_t src_addr[16];
+  u_int8_t dest_addr[16];
 };
 
 struct ipv4_info {
   char src_ip[16];
   char dest_ip[16];
+  u_int8_t src_addr[4];
+  u_int8_t dest_addr[4];
 };
 
 struct tcp_info{
+  u_int8_t present; // 1 if the packet carries a TCP header
   u_int16_t src_port;
   u_int16_t dest_port;
+  u_int32_t seq;
+  u_int8_t flags;
 
-  char* payload;
+  const u_char* payload; // points into the captured packet
+  int payload_length;
 };
 
+/* Reassembly limits. Segment storage is TCP_SEGMENT_POOL_SIZE blocks of
+   2KB, shared by all streams. If the memory budget is too small, the
+   stream table and pool are halved until they fit, down to
+   TCP_MIN_SEGMENT_POOL_SIZE. */
+#define TCP_MAX_STREAMS 65536
+#define TCP_SEGMENT_POOL_SIZE 8192
+#define TCP_MIN_SEGMENT_POOL_SIZE 64
+#define TCP_STREAM_BUFFER_LIMIT (64 * 1024)
+#define TCP_STREAM_IDLE_TIMEOUT 120 // seconds
+
+/* Largest amount of stream data shown for a single packet. */
+#define PAYLOAD_VIEW_SIZE 65536
+/* Pieces of stream data a single packet can make available. */
+#define PAYLOAD_VIEW_CHUNKS 64
+
 struct packet_info {
   char src_mac[18];
   char dest_mac[18];
@@ -70,17 +100,22 @@ struct packet_info get_packet_info(const u_char* packet, int length) {
 
   // Extract IPv6 header if present
   if (eth->type == 0x86DD) {
+    // Short frames are padded to the Ethernet minimum, so the end of the
+    // packet comes from the IP header and not from the capture length.
+    int ip_end = offset + 40 + ((packet[offset + 4] << 8) | packet[offset + 5]);
     offset += 6; // Skip version, traffic class, flow label, and payload length
     u_int8_t next_header = (u_int8_t)packet[offset];
     offset += 2; // Also skip hop limit
 
     // Source IP
+    memcpy(info.ipv6.src_addr, packet + offset, 16);
     for (int i = 0; i < 16; i++) {
       sprintf(info.ipv6.src_ip + i * 2, "%02x", packet[offset + i]);
     }
     info.ipv6.src_ip[39] = '\0';
     offset += 16;
     // Destination IP
+    memcpy(info.ipv6.dest_addr, packet + offset, 16);
     for (int i = 0; i < 16; i++) {
       sprintf(info.ipv6.dest_ip + i * 2, "%02x", packet[offset + i]);
     }
@@ -128,31 +163,40 @@ struct packet_info get_packet_info(const u_char* packet, int length) {
       strcpy(info.eth_type, "IPv6 ICMP");
     }else if (next_header == 6){
       strcpy(info.eth_type, "IPv6 TCP");
-      struct tcp_info tcp_info;
-      tcp_info.src_port = ntohs(*(u_int16_t*)(packet + offset));
+      info.tcp.present = 1;
+      info.tcp.src_port = ntohs(*(u_int16_t*)(packet + offset));
       offset += 2;
-      tcp_info.dest_port = ntohs(*(u_int16_t*)(packet + offset));
+      info.tcp.dest_port = ntohs(*(u_int16_t*)(packet + offset));
       offset += 2;
-      info.tcp = tcp_info;
+      memcpy(&info.tcp.seq, packet + offset, 4);
+      info.tcp.seq = ntohl(info.tcp.seq);
       offset += 8; // Skip sequence number and acknowledgment number
       u_int8_t data_offset = (u_int8_t)(packet[offset] >> 4);
+      info.tcp.flags = (u_int8_t)packet[offset + 1];
       offset += data_offset * 4 - 12; // Move to the end of the TCP header
 
-      int payload_length = length - offset;
-      info.tcp.payload = (char*)malloc(payload_length);
-      memcpy(info.tcp.payload, packet + offset, payload_length);
+      // The payload is left in the capture buffer; it is only copied if it
+      // ends up being sent to the callback.
+      if (ip_end > length) ip_end = length;
+      if (offset < ip_end) {
+        info.tcp.payload = packet + offset;
+        info.tcp.payload_length = ip_end - offset;
+      }
     }else if (next_header == 17){
       strcpy(info.eth_type, "IPv6 UDP");
     }
   } else if (eth->type == 0x0800) {
     u_int8_t data_offset = (u_int8_t)(packet[offset] & 0x0F);
+    int ip_end = offset + ((packet[offset + 2] << 8) | packet[offset + 3]);
     offset += 9; // Skip version, IHL, DSCP, ECN, total length, identification, flags, fragment offset, and TTL
     u_int8_t protocol = (u_int8_t)packet[offset];
     offset += 3; // Also skip headers checksum
     // Source IP
+    memcpy(info.ipv4.src_addr, packet + offset, 4);
     sprintf(info.ipv4.src_ip, "%d.%d.%d.%d", (u_int8_t)packet[offset], (u_int8_t)packet[offset + 1], (u_int8_t)packet[offset + 2], (u_int8_t)packet[offset + 3]);
     offset += 4;
     // Destination IP
+    memcpy(info.ipv4.dest_addr, packet + offset, 4);
     sprintf(info.ipv4.dest_ip, "%d.%d.%d.%d", (u_int8_t)packet[offset], (u_int8_t)packet[offset + 1], (u_int8_t)packet[offset + 2], (u_int8_t)packet[offset + 3]);
     offset += 4;
 
@@ -161,19 +205,25 @@ struct packet_info get_packet_info(const u_char* packet, int length) {
       strcpy(info.eth_type, "IPv4 ICMP");
     } else if (protocol == 6) {
       strcpy(info.eth_type, "IPv4 TCP");
-      struct tcp_info tcp_info;
-      tcp_info.src_port = ntohs(*(u_int16_t*)(packet + offset));
+      info.tcp.present = 1;
+      info.tcp.src_port = ntohs(*(u_int16_t*)(packet + offset));
       offset += 2;
-      tcp_info.dest_port = ntohs(*(u_int16_t*)(packet + offset));
+      info.tcp.dest_port = ntohs(*(u_int16_t*)(packet + offset));
       offset += 2;
-      info.tcp = tcp_info;
+      memcpy(&info.tcp.seq, packet + offset, 4);
+      info.tcp.seq = ntohl(info.tcp.seq);
       offset += 8; // Skip sequence number and acknowledgment number
       u_int8_t data_offset = (u_int8_t)(packet[offset] >> 4);
+      info.tcp.flags = (u_int8_t)packet[offset + 1];
       offset += data_offset * 4 - 12; // Move to the end of the TCP header
 
-      int payload_length = length - offset;
-      info.tcp.payload = (char*)malloc(payload_length);
-      memcpy(info.tcp.payload, packet + offset, payload_length);
+      // The payload is left in the capture buffer; it is only copied if it
+      // ends up being sent to the callback.
+      if (ip_end > length) ip_end = length;
+      if (offset < ip_end) {
+        info.tcp.payload = packet + offset;
+        info.tcp.payload_length = ip_end - offset;
+      }
     } else if (protocol == 17) {
       strcpy(info.eth_type, "IPv4 UDP");
     }
@@ -183,51 +233,14 @@ struct packet_info get_packet_info(const u_char* packet, int length) {
 }
 
 /*
-  * Get a list of network interfaces that support monitor mode.
+  * Get a list of all network interfaces pcap can capture on. The list comes
+  * from the interface inventory, so no devices are opened here.
   * @param interfaces: A pointer to an array of strings to store the interface names.
   * @param count: A pointer to an integer to store the number of interfaces found.
   * @return: 0 on success, 2 on error
 */
 int get_all_interfaces(char **interfaces[], int *count) {
-  char errbuf[PCAP_ERRBUF_SIZE];
-  pcap_if_t *devs;
-
-  if (pcap_findalldevs(&devs, errbuf) != 0){
-    fprintf(stderr, "Error getting interfaces: %s\n", errbuf);
-    return (2);
-  }
-  if (devs == NULL){
-    *count = 0;
-    return (0);
-  }
-
-  *count = 0;
-  for (pcap_if_t *d = devs; d != NULL; d = d->next) {
-      pcap_t *dev = pcap_create(d->name, errbuf);
-      if (dev == NULL) {
-          continue;
-      }
-      pcap_close(dev);
-      (*count)++;
-  }
-
-  *interfaces = (char **)malloc((*count) * sizeof(char *));
-
-  int i = 0; pcap_if_t *d = devs;
-  while (d != NULL && i < *count) {
-    pcap_t *dev = pcap_create(d->name, errbuf);
-    if (dev == NULL) {
-        continue;
-    }
-    (*interfaces)[i] = (char *)malloc((strlen(d->name) + 1) * sizeof(char));
-    strcpy((*interfaces)[i], d->name);
-    i++;
-    d = d->next;
-    pcap_close(dev);
-  }
-
-  pcap_freealldevs(devs);
-  return 0;
+  return interface_inventory_names(interfaces, count, 0);
 }
 
 /*
@@ -247,26 +260,308 @@ int free_all_interfaces(char **interfaces, int count) {
 /* Global handle so stop_capture() can break the loop from any thread. */
 static pcap_t *active_handle = NULL;
 
+/* The matcher used by the capture thread, and a replacement waiting to be
+   picked up. Only the capture thread touches active_matcher, so a matcher
+   is never freed while it is being scanned. */
+static struct payload_matcher *active_matcher = NULL;
+static _Atomic(struct payload_matcher *) pending_matcher = NULL;
+
+/* Owns all memory of the running capture; released in bulk when it stops. */
+static struct memory_session session;
+static _Atomic int capture_running = 0;
+
+/* Serialises set_payload_patterns(), so only one matcher is built at a time. */
+static pthread_mutex_t patterns_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Only exist while a capture is running. */
+static struct tcp_reassembly *reassembly = NULL;
+
+/* Stream data made available by the packet being handled. The chunks
+   point into the capture buffer or the reassembler's segment blocks, which
+   stay valid until the next packet, so nothing is copied unless the
+   payload is actually passed on. */
+struct payload_chunk {
+  const u_char *data;
+  int length;
+};
+struct payload_view {
+  u_char *data; // PAYLOAD_VIEW_SIZE bytes to join chunks in, or NULL if it didn't fit the budget
+  struct payload_chunk chunks[PAYLOAD_VIEW_CHUNKS];
+  int chunk_count;
+  int length;
+  int matches;
+};
+static struct payload_view view;
+
 /* Stub for standalone builds. */
 #ifndef CGO_BUILD
 void on_packet_captured(char *src_mac, char *dest_mac, char *eth_type,
                        char *src_ipv4, char *dest_ipv4,
                        char *src_ipv6, char *dest_ipv6,
                        int src_port, int dest_port,
-                       char *payload, int payload_length) {
+                       char *payload, int payload_length, int match_count) {
   (void)payload;
   (void)payload_length;
   printf("Packet: %s -> %s [%s]\n", src_mac, dest_mac, eth_type);
+  if (match_count > PAYLOAD_MAX_REPORTED_MATCHES) {
+    printf("  ... %d more matches\n", match_count - PAYLOAD_MAX_REPORTED_MATCHES);
+  }
   if (src_ipv4[0]) printf("  IPv4: %s -> %s\n", src_ipv4, dest_ipv4);
   if (src_ipv6[0]) printf("  IPv6: %s -> %s\n", src_ipv6, dest_ipv6);
   if (src_port > 0) printf("  TCP: %d -> %d\n", src_port, dest_port);
 }
+
+void on_payload_match(char *pattern, int pattern_length, unsigned int offset) {
+  printf("  Match: \"%.*s\" at offset %u\n", pattern_length, pattern, offset);
+}
+
+void on_interfaces_changed(void) {
+}
 #endif
 
+/*
+  * Replace the set of payload patterns. Safe to call from any thread, also
+  * while a capture is running; the capture thread switches over before the
+  * next packet. An empty list disables matching. Pattern sets whose
+  * matcher doesn't fit the memory budget (or, during a capture, what the
+  * capture has left of it) are refused.
+  * @param patterns: The pattern bytes (not necessarily null terminated).
+  * @param lengths: The length of each pattern.
+  * @param count: The number of patterns.
+  * @return: 0 on success, 1 on error
+*/
+int set_payload_patterns(const char **patterns, const int *lengths, int count) {
+  pthread_mutex_lock(&patterns_lock);
+
+  // A replacement nobody picked up yet is superseded. Drop it before
+  // building the new one, so it doesn't add to the memory held meanwhile.
+  payload_matcher_free(atomic_exchange(&pending_matcher, NULL));
+
+  // The automaton can take tens of MB, so it is checked before it is
+  // built. During a capture it must fit next to everything the session
+  // holds, the old matcher included, since both exist until the capture
+  // thread swaps them.
+  size_t size = payload_matcher_memory_size(lengths, count);
+  size_t available = get_memory_budget() != 0 ? get_memory_budget() : SIZE_MAX;
+  if (atomic_load(&capture_running)) {
+    size_t left = session_memory_available(&session);
+    if (left < available) available = left;
+  }
+  if (size == SIZE_MAX) {
+    fprintf(stderr, "Couldn't build payload matcher: patterns too long\n");
+    pthread_mutex_unlock(&patterns_lock);
+    return 1;
+  }
+  if (size > available) {
+    fprintf(stderr, "Couldn't build payload matcher: it needs %zu bytes, the memory budget has %zu left\n",
+            size, available);
+    pthread_mutex_unlock(&patterns_lock);
+    return 1;
+  }
+
+  struct payload_matcher *matcher = payload_matcher_create(patterns, lengths, count);
+  if (matcher == NULL) {
+    fprintf(stderr, "Couldn't build payload matcher\n");
+    pthread_mutex_unlock(&patterns_lock);
+    return 1;
+  }
+
+  payload_matcher_free(atomic_exchange(&pending_matcher, matcher));
+  pthread_mutex_unlock(&patterns_lock);
+  return 0;
+}
+
+static void update_active_matcher(void) {
+  if (atomic_load_explicit(&pending_matcher, memory_order_relaxed) == NULL) {
+    return;
+  }
+
+  struct payload_matcher *matcher = atomic_exchange(&pending_matcher, NULL);
+  if (matcher == NULL) {
+    return;
+  }
+  if (payload_matcher_pattern_count(matcher) == 0) {
+    payload_matcher_free(matcher);
+    matcher = NULL;
+  }
+
+  // The active matcher is charged to the session's aggregates.
+  session_memory_uncharge(&session, MEMORY_AGGREGATES, payload_matcher_size(active_matcher));
+  if (session_memory_charge(&session, MEMORY_AGGREGATES, payload_matcher_size(matcher)) != 0) {
+    fprintf(stderr, "Memory budget too small for the new payload patterns, keeping the old ones\n");
+    session_memory_charge(&session, MEMORY_AGGREGATES, payload_matcher_size(active_matcher));
+    payload_matcher_free(matcher);
+    return;
+  }
+  payload_matcher_free(active_matcher);
+  active_matcher = matcher;
+
+  // Automaton states saved in the streams belong to the old matcher.
+  if (reassembly != NULL) {
+    tcp_reassembly_reset_user_state(reassembly);
+  }
+}
+
+static void payload_match_found(const struct payload_pattern *pattern, u_int32_t offset, void *user) {
+  struct payload_view *v = user;
+  if (v->matches < PAYLOAD_MAX_REPORTED_MATCHES) {
+    on_payload_match(pattern->bytes, pattern->length, offset);
+  }
+  v->matches++;
+}
+
+/* Receives in-order stream data from the reassembler. */
+static void stream_data(const u_char *data, int length, u_int32_t stream_offset,
+                        int *match_state, void *user) {
+  struct payload_view *v = user;
+
+  if (active_matcher != NULL) {
+    payload_matcher_scan(active_matcher, data, length, match_state,
+                         stream_offset, payload_match_found, v);
+  }
+
+  if (v->chunk_count < PAYLOAD_VIEW_CHUNKS && v->length < PAYLOAD_VIEW_SIZE) {
+    int room = PAYLOAD_VIEW_SIZE - v->length;
+    v->chunks[v->chunk_count].data = data;
+    v->chunks[v->chunk_count].length = length < room ? length : room;
+    v->length += v->chunks[v->chunk_count].length;
+    v->chunk_count++;
+  }
+}
+
+/*
+  * Get the view's data in one piece. A single chunk (the usual in-order
+  * case) is returned as is; several are copied into the view's buffer.
+  * Without that buffer only the first chunk is returned.
+  * @param length: Where to store the number of bytes returned.
+  * @return: The data, or NULL if there is none.
+*/
+static const u_char *payload_view_join(struct payload_view *v, int *length) {
+  *length = 0;
+  if (v->chunk_count == 0) {
+    return NULL;
+  }
+  if (v->chunk_count == 1 || v->data == NULL) {
+    *length = v->chunks[0].length;
+    return v->chunks[0].data;
+  }
+
+  for (int i = 0; i < v->chunk_count; i++) {
+    memcpy(v->data + *length, v->chunks[i].data, v->chunks[i].length);
+    *length += v->chunks[i].length;
+  }
+  return v->data;
+}
+
+/* Charge the matcher kept from an earlier capture to a new session, or
+   drop it if the budget was lowered below its size since. */
+static void charge_active_matcher(void) {
+  if (active_matcher == NULL) {
+    return;
+  }
+  if (session_memory_charge(&session, MEMORY_AGGREGATES, payload_matcher_size(active_matcher)) != 0) {
+    fprintf(stderr, "Memory budget too small for the payload patterns, matching disabled\n");
+    payload_matcher_free(active_matcher);
+    active_matcher = NULL;
+  }
+}
+
+/*
+  * Allocate everything the capture needs up front from the session, so
+  * nothing is allocated per packet. The payload matcher is charged first;
+  * when the rest of the budget is too small, the reassembly tables are
+  * halved until they fit, and reassembly is turned off if even the
+  * smallest size doesn't.
+*/
+static void setup_capture_session(void) {
+  int streams = TCP_MAX_STREAMS;
+  int segments = TCP_SEGMENT_POOL_SIZE;
+
+  session_memory_init(&session, get_memory_budget());
+  atomic_store(&capture_running, 1);
+  charge_active_matcher();
+  update_active_matcher();
+  for (;;) {
+    view.data = session_memory_alloc(&session, MEMORY_BUFFERS, PAYLOAD_VIEW_SIZE);
+    reassembly = tcp_reassembly_create(&session, streams, segments,
+                                       TCP_STREAM_BUFFER_LIMIT, TCP_STREAM_IDLE_TIMEOUT);
+    if (reassembly != NULL) {
+      break;
+    }
+
+    // Whatever the failed attempt got stays reserved until the session is
+    // destroyed, so start over.
+    session_memory_destroy(&session);
+    charge_active_matcher();
+    if (segments <= TCP_MIN_SEGMENT_POOL_SIZE) {
+      view.data = session_memory_alloc(&session, MEMORY_BUFFERS, PAYLOAD_VIEW_SIZE);
+      break;
+    }
+    streams /= 2;
+    segments /= 2;
+  }
+
+  if (view.data == NULL) {
+    fprintf(stderr, "Memory budget too small, payloads spanning several segments will be cut short\n");
+  }
+  if (reassembly == NULL) {
+    fprintf(stderr, "Memory budget too small, payloads will not be reassembled\n");
+  } else if (segments < TCP_SEGMENT_POOL_SIZE) {
+    fprintf(stderr, "Memory budget too small, reassembly limited to %d streams\n", streams);
+  }
+}
+
+/*
+  * Get the memory use of the running packet capture, per subsystem.
+  * Safe to call from any thread.
+  * @param usage: Where to store the usage.
+  * @return: 0 on success
+*/
+int get_packet_capture_memory_usage(struct memory_usage *usage) {
+  session_memory_usage(&session, usage);
+  return 0;
+}
+
 void packet_capture_handler(u_char *user, const struct pcap_pkthdr *header, const u_char *packet) {
   (void)user;
 
+  update_active_matcher();
+
   struct packet_info info = get_packet_info(packet, header->caplen);
+
+  view.chunk_count = 0;
+  view.length = 0;
+  view.matches = 0;
+  if (info.tcp.present && reassembly != NULL) {
+    struct tcp_stream_key key;
+    memset(&key, 0, sizeof(struct tcp_stream_key));
+    if (info.ipv4.src_ip[0]) {
+      key.family = 4;
+      memcpy(key.src_addr, info.ipv4.src_addr, 4);
+      memcpy(key.dest_addr, info.ipv4.dest_addr, 4);
+    } else {
+      key.family = 6;
+      memcpy(key.src_addr, info.ipv6.src_addr, 16);
+      memcpy(key.dest_addr, info.ipv6.dest_addr, 16);
+    }
+    key.src_port = info.tcp.src_port;
+    key.dest_port = info.tcp.dest_port;
+
+    tcp_reassembly_process(reassembly, &key, info.tcp.seq, info.tcp.flags,
+                           info.tcp.payload, info.tcp.payload_length,
+                           header->ts.tv_sec, stream_data, &view);
+  } else if (info.tcp.payload_length > 0) {
+    int state = 0;
+    stream_data(info.tcp.payload, info.tcp.payload_length, 0, &state, &view);
+  }
+
+  // With patterns loaded, only packets that match carry their payload
+  // over to the callback, so only those are ever copied.
+  const u_char *payload = NULL;
+  int payload_length = 0;
+  if (active_matcher == NULL || view.matches > 0) {
+    payload = payload_view_join(&view, &payload_length);
+  }
   
   // Prepare data for callback
   char empty_ipv4[16] = "";
@@ -283,15 +578,15 @@ void packet_capture_handler(u_char *user, const struct pcap_pkthdr *header, cons
     info.ipv6.dest_ip[0] ? info.ipv6.dest_ip : empty_ipv6,
     info.tcp.src_port,
     info.tcp.dest_port,
-    info.tcp.payload,
-    info.tcp.payload ? strlen(info.tcp.payload) : 0
+    payload_length > 0 ? (char *)payload : NULL,
+    payload_length,
+    view.matches
   );
-    
-  free(info.tcp.payload);
 }
 
 /*
-  * Start capturing beacon frames on the given interface (monitor mode).
+  * Start capturing packets on the given interface. TCP payloads are
+  * reassembled per stream before they are matched and reported.
   * Blocks until stop_packet_capture() is called or an error occurs.
   * @param interface_name: The name of the interface.
   * @return: 0 on success, 1 on error
@@ -323,6 +618,8 @@ int start_packet_capture(const char *interface_name) {
     return 1;
   }
 
+  setup_capture_session();
+
   active_handle = handle;
 
   /* Blocks until pcap_breakloop() is called or an error occurs. */
@@ -332,6 +629,10 @@ int start_packet_capture(const char *interface_name) {
   }
 
   active_handle = NULL;
+  reassembly = NULL;
+  view.data = NULL;
+  atomic_store(&capture_running, 0);
+  session_memory_destroy(&session);
   pcap_close(handle);
   return (result == PCAP_ERROR) ? 1 : 0;
 }
@@ -350,10 +651,21 @@ int stop_packet_capture(void) {
 /* ---- standalone build (Makefile) ---- */
 #ifndef CGO_BUILD
 
-int main() {
+int main(int argc, char *argv[]) {
   char **interfaces;
   int count;
 
+  // Any arguments are used as payload patterns.
+  if (argc > 1) {
+    int lengths[argc - 1];
+    for (int i = 1; i < argc; i++) {
+      lengths[i - 1] = strlen(argv[i]);
+    }
+    if (set_payload_patterns((const char **)(argv + 1), lengths, argc - 1) != 0) {
+      return 1;
+    }
+  }
+
   if (get_all_interfaces(&interfaces, &count) != 0) {
     fprintf(stderr, "Failed to get interfaces\n");
     return 1;
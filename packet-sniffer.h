@@ -1,20 +1,36 @@
 #ifndef PACKET_SNIFFER_H
 #define PACKET_SNIFFER_H
 
+#include "session-arena.h"
 
 int get_all_interfaces(char **interfaces[], int *count);
 int free_all_interfaces(char **interfaces, int count);
 
 int start_packet_capture(const char *interface_name);
 int stop_packet_capture(void);
+int set_payload_patterns(const char **patterns, const int *lengths, int count);
+int get_packet_capture_memory_usage(struct memory_usage *usage);
 
 /* Callback implemented in Go (via //export) when built with cgo,
-   or in C for standalone builds. Called for every captured packet. */
+   or in C for standalone builds. Called for every captured packet.
+   For TCP, the payload is the reassembled stream data that this packet
+   made available, in order, which may be empty or span several segments.
+   match_count is the number of pattern matches in that data, of which at
+   most PAYLOAD_MAX_REPORTED_MATCHES were reported. */
 extern void on_packet_captured(
     char *src_mac, char *dest_mac, char *eth_type,
     char *src_ipv4, char *dest_ipv4,
     char *src_ipv6, char *dest_ipv6,
     int src_port, int dest_port,
-    char *payload, int payload_length);
+    char *payload, int payload_length, int match_count);
+
+/* Payloads are attacker controlled and a single packet can match
+   thousands of times, so only this many matches per packet are reported. */
+#define PAYLOAD_MAX_REPORTED_MATCHES 32
+
+/* Called for the first PAYLOAD_MAX_REPORTED_MATCHES pattern matches of a
+   packet, before on_packet_captured() is called for it. For TCP the offset
+   is relative to the start of the stream and wraps around after 4 GiB. */
+extern void on_payload_match(char *pattern, int pattern_length, unsigned int offset);
 
 #endif /* PACKET_SNIFFER_H */
@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "payload-matcher.h"
+
+/* Above this many distinct first bytes the vector compare loop costs more
+   than the plain lookup table, so the prefilter falls back to scalar. */
+#define PREFILTER_MAX_BYTES 16
+
+struct payload_matcher {
+  struct payload_pattern *patterns;
+  int pattern_count;
+  size_t memory_size;
+
+  int state_count;
+  u_int16_t *next; // state_count * 256 transitions (full DFA)
+  int32_t *output; // pattern ending in this state, or -1
+  int32_t *dict; // next state on the failure chain with an output, or -1
+
+  u_int8_t first_byte[256]; // 1 if some pattern starts with this byte
+  int first_count;
+#ifdef __SSE2__
+  __m128i needles[PREFILTER_MAX_BYTES]; // each first byte in all 16 lanes
+#endif
+};
+
+/*
+  * How much memory a matcher for these patterns holds, so it can be
+  * checked against a budget before it is built.
+  * @param lengths: The length of each pattern.
+  * @param count: The number of patterns.
+  * @return: The size in bytes, or SIZE_MAX if the patterns are too long.
+*/
+size_t payload_matcher_memory_size(const int *lengths, int count) {
+  size_t states = 1;
+  size_t pattern_bytes = 0;
+  for (int i = 0; i < count; i++) {
+    if (lengths[i] > 0) {
+      states += lengths[i];
+      pattern_bytes += lengths[i];
+    }
+    if (states > PAYLOAD_MATCHER_MAX_STATES) return SIZE_MAX;
+  }
+  return sizeof(struct payload_matcher) +
+         (count > 0 ? count : 1) * sizeof(struct payload_pattern) + pattern_bytes +
+         states * (256 * sizeof(u_int16_t) + 2 * sizeof(int32_t));
+}
+
+/*
+  * Build an Aho-Corasick automaton from a list of patterns.
+  * Empty patterns are ignored.
+  * @param patterns: The pattern bytes (not necessarily null terminated).
+  * @param lengths: The length of each pattern.
+  * @param count: The number of patterns.
+  * @return: The matcher, or NULL if out of memory or the patterns are too long.
+*/
+struct payload_matcher *payload_matcher_create(const char **patterns,
+                                               const int *lengths, int count) {
+  int max_states = 1;
+  for (int i = 0; i < count; i++) {
+    if (lengths[i] > 0) max_states += lengths[i];
+    if (max_states > PAYLOAD_MATCHER_MAX_STATES) return NULL;
+  }
+
+  struct payload_matcher *m = calloc(1, sizeof(struct payload_matcher));
+  if (m == NULL) return NULL;
+  m->memory_size = payload_matcher_memory_size(lengths, count);
+
+  m->patterns = calloc(count > 0 ? count : 1, sizeof(struct payload_pattern));
+  m->next = calloc((size_t)max_states * 256, sizeof(u_int16_t));
+  m->output = malloc(max_states * sizeof(int32_t));
+  m->dict = malloc(max_states * sizeof(int32_t));
+  int *queue = malloc(max_states * sizeof(int));
+  int32_t *fail = calloc(max_states, sizeof(int32_t));
+  if (m->patterns == NULL || m->next == NULL || m->output == NULL ||
+      m->dict == NULL || queue == NULL || fail == NULL) {
+    free(queue);
+    free(fail);
+    payload_matcher_free(m);
+    return NULL;
+  }
+  memset(m->output, 0xff, max_states * sizeof(int32_t));
+  memset(m->dict, 0xff, max_states * sizeof(int32_t));
+
+  // Build the trie. State 0 is the root, and since no trie edge ever leads
+  // back to it, a 0 transition means "no edge" until the BFS below.
+  m->state_count = 1;
+  for (int i = 0; i < count; i++) {
+    if (lengths[i] <= 0) continue;
+
+    struct payload_pattern *p = &m->patterns[m->pattern_count];
+    p->bytes = malloc(lengths[i]);
+    if (p->bytes == NULL) {
+      free(queue);
+      free(fail);
+      payload_matcher_free(m);
+      return NULL;
+    }
+    memcpy(p->bytes, patterns[i], lengths[i]);
+    p->length = lengths[i];
+
+    int state = 0;
+    for (int j = 0; j < p->length; j++) {
+      u_int8_t c = (u_int8_t)p->bytes[j];
+      if (m->next[state * 256 + c] == 0) {
+        m->next[state * 256 + c] = (u_int16_t)m->state_count++;
+      }
+      state = m->next[state * 256 + c];
+    }
+    if (m->output[state] < 0) m->output[state] = m->pattern_count;
+
+    u_int8_t first = (u_int8_t)p->bytes[0];
+    if (!m->first_byte[first]) {
+      m->first_byte[first] = 1;
+#ifdef __SSE2__
+      if (m->first_count < PREFILTER_MAX_BYTES) m->needles[m->first_count] = _mm_set1_epi8((char)first);
+#endif
+      m->first_count++;
+    }
+    m->pattern_count++;
+  }
+
+  // Compute failure links breadth first and turn the trie into a full DFA.
+  int head = 0, tail = 0;
+  for (int c = 0; c < 256; c++) {
+    int child = m->next[c];
+    if (child != 0) queue[tail++] = child;
+  }
+  while (head < tail) {
+    int state = queue[head++];
+    for (int c = 0; c < 256; c++) {
+      int child = m->next[state * 256 + c];
+      int fallback = m->next[fail[state] * 256 + c];
+      if (child != 0) {
+        fail[child] = fallback;
+        m->dict[child] = m->output[fallback] >= 0 ? fallback : m->dict[fallback];
+        queue[tail++] = child;
+      } else {
+        m->next[state * 256 + c] = (u_int16_t)fallback;
+      }
+    }
+  }
+
+  free(queue);
+  free(fail);
+  return m;
+}
+
+/*
+  * Free a matcher created by payload_matcher_create().
+  * @param matcher: The matcher to free (may be NULL).
+*/
+void payload_matcher_free(struct payload_matcher *matcher) {
+  if (matcher == NULL) return;
+  if (matcher->patterns != NULL) {
+    for (int i = 0; i < matcher->pattern_count; i++) {
+      free(matcher->patterns[i].bytes);
+    }
+  }
+  free(matcher->patterns);
+  free(matcher->next);
+  free(matcher->output);
+  free(matcher->dict);
+  free(matcher);
+}
+
+int payload_matcher_pattern_count(const struct payload_matcher *matcher) {
+  return matcher != NULL ? matcher->pattern_count : 0;
+}
+
+size_t payload_matcher_size(const struct payload_matcher *matcher) {
+  return matcher != NULL ? matcher->memory_size : 0;
+}
+
+/*
+  * Find the next position that can start a match, so the automaton only
+  * runs while it is away from the root or sitting on a candidate byte.
+  * @return: The index of the candidate byte, or length if there is none.
+*/
+static int skip_to_candidate(const struct payload_matcher *m,
+                             const unsigned char *data, int i, int length) {
+#ifdef __SSE2__
+  if (m->first_count <= PREFILTER_MAX_BYTES) {
+    while (i + 16 <= length) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+      __m128i hits = _mm_setzero_si128();
+      for (int k = 0; k < m->first_count; k++) {
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, m->needles[k]));
+      }
+      int mask = _mm_movemask_epi8(hits);
+      if (mask != 0) return i + __builtin_ctz(mask);
+      i += 16;
+    }
+  }
+#endif
+  while (i < length && !m->first_byte[data[i]]) i++;
+  return i;
+}
+
+/*
+  * Run the automaton over a block of data.
+  * The state is carried in and out so a stream can be scanned in pieces;
+  * start a new scan with *state = 0.
+  * @param data: The bytes to scan.
+  * @param length: The number of bytes.
+  * @param state: In/out automaton state.
+  * @param base_offset: Offset of data[0] within the stream, added to match offsets.
+  * @param callback: Called for every match (may be NULL to only count).
+  * @param user: Passed through to the callback.
+  * @return: The number of matches found.
+*/
+int payload_matcher_scan(const struct payload_matcher *matcher,
+                         const unsigned char *data, int length,
+                         int *state, u_int32_t base_offset,
+                         payload_match_cb callback, void *user) {
+  if (matcher == NULL || matcher->pattern_count == 0) return 0;
+
+  const u_int16_t *next = matcher->next;
+  int s = *state;
+  int matches = 0;
+
+  for (int i = 0; i < length; i++) {
+    if (s == 0) {
+      i = skip_to_candidate(matcher, data, i, length);
+      if (i >= length) break;
+    }
+    s = next[s * 256 + data[i]];
+
+    int hit = matcher->output[s] >= 0 ? s : matcher->dict[s];
+    while (hit >= 0) {
+      const struct payload_pattern *p = &matcher->patterns[matcher->output[hit]];
+      // A match may have started in an earlier block; the unsigned
+      // arithmetic wraps to the right stream offset.
+      if (callback != NULL) callback(p, base_offset + (u_int32_t)i + 1 - (u_int32_t)p->length, user);
+      matches++;
+      hit = matcher->dict[hit];
+    }
+  }
+
+  *state = s;
+  return matches;
+}
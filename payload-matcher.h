@@ -0,0 +1,35 @@
+#ifndef PAYLOAD_MATCHER_H
+#define PAYLOAD_MATCHER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* The automaton stores states as 16 bit indices, which bounds the total
+   length of all patterns in a single matcher. */
+#define PAYLOAD_MATCHER_MAX_STATES 65535
+
+struct payload_matcher;
+
+struct payload_pattern {
+  char *bytes;
+  int length;
+};
+
+/* Called for every match. The offset is where the pattern starts,
+   relative to the beginning of the scanned data plus base_offset. Like
+   TCP sequence numbers, offsets wrap around after 4 GiB. */
+typedef void (*payload_match_cb)(const struct payload_pattern *pattern,
+                                 u_int32_t offset, void *user);
+
+size_t payload_matcher_memory_size(const int *lengths, int count);
+struct payload_matcher *payload_matcher_create(const char **patterns,
+                                               const int *lengths, int count);
+void payload_matcher_free(struct payload_matcher *matcher);
+int payload_matcher_pattern_count(const struct payload_matcher *matcher);
+size_t payload_matcher_size(const struct payload_matcher *matcher);
+int payload_matcher_scan(const struct payload_matcher *matcher,
+                         const unsigned char *data, int length,
+                         int *state, u_int32_t base_offset,
+                         payload_match_cb callback, void *user);
+
+#endif /* PAYLOAD_MATCHER_H */
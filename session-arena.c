@@ -0,0 +1,208 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "session-arena.h"
+
+/* Chunks are at least this big; larger allocations get a chunk of their own. */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  unsigned char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+static _Atomic size_t memory_budget = DEFAULT_MEMORY_BUDGET;
+
+/*
+  * Set the memory budget for capture sessions started from now on.
+  * @param budget: The budget in bytes, or 0 for no limit.
+*/
+void set_memory_budget(size_t budget) {
+  atomic_store(&memory_budget, budget);
+}
+
+size_t get_memory_budget(void) {
+  return atomic_load(&memory_budget);
+}
+
+/*
+  * Prepare an empty session. Nothing is allocated until it is needed.
+  * @param session: The session to initialise.
+  * @param budget: The most bytes the session may hold, or 0 for no limit.
+*/
+void session_memory_init(struct memory_session *session, size_t budget) {
+  atomic_store(&session->budget, budget);
+  atomic_store_explicit(&session->reserved, 0, memory_order_relaxed);
+  for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+    struct memory_arena *a = &session->arenas[i];
+    a->chunks = a->current = a->last = NULL;
+    atomic_store_explicit(&a->used, 0, memory_order_relaxed);
+    atomic_store_explicit(&a->reserved, 0, memory_order_relaxed);
+    atomic_store_explicit(&a->refused, 0, memory_order_relaxed);
+  }
+}
+
+static void count_refused(struct memory_arena *a) {
+  atomic_store_explicit(&a->refused, atomic_load_explicit(&a->refused, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+/*
+  * Allocate memory that lives until the subsystem is reset or the session
+  * is destroyed. The memory is not zeroed.
+  * @param session: The session to allocate from.
+  * @param subsystem: What the memory is used for.
+  * @param size: The number of bytes.
+  * @return: The memory (aligned to 16 bytes), or NULL if it would exceed the budget.
+*/
+void *session_memory_alloc(struct memory_session *session,
+                           enum memory_subsystem subsystem, size_t size) {
+  struct memory_arena *a = &session->arenas[subsystem];
+  size = size == 0 ? ARENA_ALIGN : (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  // Chunks before current are full; skip over any that became full too.
+  while (a->current != NULL && a->current->size - a->current->used < ARENA_ALIGN) {
+    a->current = a->current->next;
+  }
+
+  struct arena_chunk *chunk = a->current;
+  while (chunk != NULL && chunk->size - chunk->used < size) chunk = chunk->next;
+
+  if (chunk == NULL) {
+    size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    size_t total = sizeof(struct arena_chunk) + chunk_size;
+    size_t budget = atomic_load(&session->budget);
+    size_t reserved = atomic_load_explicit(&session->reserved, memory_order_relaxed);
+    if (budget != 0 && (total > budget || reserved > budget - total)) {
+      count_refused(a);
+      return NULL;
+    }
+
+    chunk = malloc(total);
+    if (chunk == NULL) {
+      count_refused(a);
+      return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+
+    if (a->last != NULL) a->last->next = chunk;
+    else a->chunks = chunk;
+    a->last = chunk;
+    if (a->current == NULL) a->current = chunk;
+
+    atomic_store_explicit(&session->reserved, reserved + total, memory_order_relaxed);
+    atomic_store_explicit(&a->reserved, atomic_load_explicit(&a->reserved, memory_order_relaxed) + total,
+                          memory_order_relaxed);
+  }
+
+  void *memory = chunk->data + chunk->used;
+  chunk->used += size;
+  atomic_store_explicit(&a->used, atomic_load_explicit(&a->used, memory_order_relaxed) + size,
+                        memory_order_relaxed);
+  return memory;
+}
+
+/*
+  * How many more bytes the session can reserve before hitting its budget.
+  * Safe to call from any thread while the session is in use.
+  * @return: The remaining budget, or SIZE_MAX if there is no limit.
+*/
+size_t session_memory_available(const struct memory_session *session) {
+  size_t budget = atomic_load(&session->budget);
+  if (budget == 0) return SIZE_MAX;
+  size_t reserved = atomic_load_explicit(&session->reserved, memory_order_relaxed);
+  return reserved < budget ? budget - reserved : 0;
+}
+
+/*
+  * Count memory a subsystem allocated by other means against the budget,
+  * for data that can't live in an arena because it is freed on its own.
+  * The charge is dropped when the session is destroyed.
+  * @param session: The session to charge.
+  * @param subsystem: What the memory is used for.
+  * @param size: The number of bytes.
+  * @return: 0 on success, 1 if it would exceed the budget
+*/
+int session_memory_charge(struct memory_session *session,
+                          enum memory_subsystem subsystem, size_t size) {
+  struct memory_arena *a = &session->arenas[subsystem];
+  size_t budget = atomic_load(&session->budget);
+  size_t reserved = atomic_load_explicit(&session->reserved, memory_order_relaxed);
+  if (budget != 0 && (size > budget || reserved > budget - size)) {
+    count_refused(a);
+    return 1;
+  }
+
+  atomic_store_explicit(&session->reserved, reserved + size, memory_order_relaxed);
+  atomic_store_explicit(&a->reserved, atomic_load_explicit(&a->reserved, memory_order_relaxed) + size,
+                        memory_order_relaxed);
+  atomic_store_explicit(&a->used, atomic_load_explicit(&a->used, memory_order_relaxed) + size,
+                        memory_order_relaxed);
+  return 0;
+}
+
+/*
+  * Give back a charge made with session_memory_charge().
+*/
+void session_memory_uncharge(struct memory_session *session,
+                             enum memory_subsystem subsystem, size_t size) {
+  struct memory_arena *a = &session->arenas[subsystem];
+  atomic_store_explicit(&session->reserved, atomic_load_explicit(&session->reserved, memory_order_relaxed) - size,
+                        memory_order_relaxed);
+  atomic_store_explicit(&a->reserved, atomic_load_explicit(&a->reserved, memory_order_relaxed) - size,
+                        memory_order_relaxed);
+  atomic_store_explicit(&a->used, atomic_load_explicit(&a->used, memory_order_relaxed) - size,
+                        memory_order_relaxed);
+}
+
+/*
+  * Give back everything allocated for one subsystem. The chunks are kept
+  * and reused, so resetting after every packet costs no malloc/free.
+*/
+void session_memory_reset(struct memory_session *session,
+                          enum memory_subsystem subsystem) {
+  struct memory_arena *a = &session->arenas[subsystem];
+  for (struct arena_chunk *c = a->chunks; c != NULL; c = c->next) {
+    c->used = 0;
+  }
+  a->current = a->chunks;
+  atomic_store_explicit(&a->used, 0, memory_order_relaxed);
+}
+
+/*
+  * Free every chunk of every subsystem. The session can be used again
+  * afterwards, with the same budget.
+*/
+void session_memory_destroy(struct memory_session *session) {
+  for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+    struct arena_chunk *c = session->arenas[i].chunks;
+    while (c != NULL) {
+      struct arena_chunk *next = c->next;
+      free(c);
+      c = next;
+    }
+  }
+  session_memory_init(session, atomic_load(&session->budget));
+}
+
+/*
+  * Take a snapshot of the session's memory use. Safe to call from any
+  * thread while the session is in use.
+*/
+void session_memory_usage(const struct memory_session *session,
+                          struct memory_usage *usage) {
+  memset(usage, 0, sizeof(struct memory_usage));
+  usage->budget = atomic_load(&session->budget);
+  for (int i = 0; i < MEMORY_SUBSYSTEM_COUNT; i++) {
+    const struct memory_arena *a = &session->arenas[i];
+    usage->used[i] = atomic_load_explicit(&a->used, memory_order_relaxed);
+    usage->reserved[i] = atomic_load_explicit(&a->reserved, memory_order_relaxed);
+    usage->refused[i] = atomic_load_explicit(&a->refused, memory_order_relaxed);
+  }
+}
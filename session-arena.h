@@ -0,0 +1,67 @@
+#ifndef SESSION_ARENA_H
+#define SESSION_ARENA_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Budget used for sessions started after set_memory_budget() was last
+   called, in bytes. 0 means no limit. */
+#define DEFAULT_MEMORY_BUDGET (64 * 1024 * 1024)
+
+/* What the memory of a capture session is used for. */
+enum memory_subsystem {
+  MEMORY_PARSER, // per-packet scratch, reset after every packet
+  MEMORY_AGGREGATES, // state kept across packets (e.g. the TCP stream table)
+  MEMORY_BUFFERS, // data buffers (e.g. TCP segment storage)
+  MEMORY_SUBSYSTEM_COUNT
+};
+
+struct arena_chunk;
+
+/* A region allocator: memory is handed out from large chunks and only
+   given back in bulk, by resetting or destroying the session. */
+struct memory_arena {
+  struct arena_chunk *chunks;
+  struct arena_chunk *current; // first chunk that may still have room
+  struct arena_chunk *last;
+  _Atomic size_t used; // bytes handed out
+  _Atomic size_t reserved; // bytes held in chunks
+  _Atomic size_t refused; // allocations refused because of the budget
+};
+
+/* All memory owned by one capture session. Allocations are refused once
+   the chunks of all subsystems together would exceed the budget, so the
+   session can never hold more than budget bytes. What happens then is up
+   to the caller: the capture code drops the packet, or at session start
+   shrinks its tables to what fits. */
+struct memory_session {
+  _Atomic size_t budget;
+  _Atomic size_t reserved;
+  struct memory_arena arenas[MEMORY_SUBSYSTEM_COUNT];
+};
+
+struct memory_usage {
+  size_t budget;
+  size_t used[MEMORY_SUBSYSTEM_COUNT];
+  size_t reserved[MEMORY_SUBSYSTEM_COUNT];
+  size_t refused[MEMORY_SUBSYSTEM_COUNT];
+};
+
+void set_memory_budget(size_t budget);
+size_t get_memory_budget(void);
+
+void session_memory_init(struct memory_session *session, size_t budget);
+void *session_memory_alloc(struct memory_session *session,
+                           enum memory_subsystem subsystem, size_t size);
+size_t session_memory_available(const struct memory_session *session);
+int session_memory_charge(struct memory_session *session,
+                          enum memory_subsystem subsystem, size_t size);
+void session_memory_uncharge(struct memory_session *session,
+                             enum memory_subsystem subsystem, size_t size);
+void session_memory_reset(struct memory_session *session,
+                          enum memory_subsystem subsystem);
+void session_memory_destroy(struct memory_session *session);
+void session_memory_usage(const struct memory_session *session,
+                          struct memory_usage *usage);
+
+#endif /* SESSION_ARENA_H */
@@ -0,0 +1,364 @@
+#include <string.h>
+#include <sys/types.h>
+#include "session-arena.h"
+#include "tcp-reassembly.h"
+
+/* Segments are stored in 2048 byte blocks, which fits a full Ethernet
+   sized payload in one block. Larger payloads (GRO/TSO) span several. */
+#define TCP_SEGMENT_DATA_SIZE 2032
+
+/* How many streams to look at when trying to free a segment block for
+   another stream once the pool runs dry. */
+#define POOL_RECLAIM_SCAN 64
+
+struct tcp_segment {
+  struct tcp_segment *next;
+  u_int32_t seq;
+  u_int16_t length;
+  u_char data[TCP_SEGMENT_DATA_SIZE];
+};
+
+/* Fixed-size block allocator backing all buffered segments. */
+struct segment_pool {
+  struct tcp_segment *blocks;
+  struct tcp_segment *free_list;
+};
+
+struct tcp_stream {
+  struct tcp_stream_key key;
+  struct tcp_stream *hash_next; // also links the free list
+  struct tcp_stream *lru_prev;
+  struct tcp_stream *lru_next;
+
+  struct tcp_segment *segments; // out-of-order data, sorted by seq
+  int buffered; // bytes held in segments
+
+  u_int32_t isn; // sequence number of the first stream byte
+  u_int32_t next_seq; // next sequence number to deliver
+  time_t last_seen;
+  int user_state;
+  int closed; // FIN seen with all data before it delivered; kept until idle
+};
+
+struct tcp_reassembly {
+  struct tcp_stream *streams;
+  struct tcp_stream *free_streams;
+  struct tcp_stream **buckets;
+  u_int32_t bucket_mask;
+
+  // Least recently used stream at the head
+  struct tcp_stream *lru_head;
+  struct tcp_stream *lru_tail;
+
+  struct segment_pool pool;
+  int stream_buffer_limit;
+  int idle_timeout;
+};
+
+/* Signed distance between two sequence numbers, handling wraparound. */
+static int32_t seq_diff(u_int32_t a, u_int32_t b) {
+  return (int32_t)(a - b);
+}
+
+static u_int32_t hash_key(const struct tcp_stream_key *key) {
+  const u_int8_t *bytes = (const u_int8_t *)key;
+  u_int32_t hash = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < sizeof(struct tcp_stream_key); i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static int pool_init(struct segment_pool *pool, struct memory_session *memory, int count) {
+  pool->blocks = session_memory_alloc(memory, MEMORY_BUFFERS, (size_t)count * sizeof(struct tcp_segment));
+  if (pool->blocks == NULL) return 1;
+
+  pool->free_list = NULL;
+  for (int i = count - 1; i >= 0; i--) {
+    pool->blocks[i].next = pool->free_list;
+    pool->free_list = &pool->blocks[i];
+  }
+  return 0;
+}
+
+static struct tcp_segment *pool_get(struct segment_pool *pool) {
+  struct tcp_segment *segment = pool->free_list;
+  if (segment != NULL) pool->free_list = segment->next;
+  return segment;
+}
+
+static void pool_put(struct segment_pool *pool, struct tcp_segment *segment) {
+  segment->next = pool->free_list;
+  pool->free_list = segment;
+}
+
+static void lru_remove(struct tcp_reassembly *r, struct tcp_stream *stream) {
+  if (stream->lru_prev != NULL) stream->lru_prev->lru_next = stream->lru_next;
+  else r->lru_head = stream->lru_next;
+  if (stream->lru_next != NULL) stream->lru_next->lru_prev = stream->lru_prev;
+  else r->lru_tail = stream->lru_prev;
+  stream->lru_prev = stream->lru_next = NULL;
+}
+
+static void lru_append(struct tcp_reassembly *r, struct tcp_stream *stream) {
+  stream->lru_prev = r->lru_tail;
+  stream->lru_next = NULL;
+  if (r->lru_tail != NULL) r->lru_tail->lru_next = stream;
+  else r->lru_head = stream;
+  r->lru_tail = stream;
+}
+
+static void free_segments(struct tcp_reassembly *r, struct tcp_stream *stream) {
+  while (stream->segments != NULL) {
+    struct tcp_segment *segment = stream->segments;
+    stream->segments = segment->next;
+    pool_put(&r->pool, segment);
+  }
+  stream->buffered = 0;
+}
+
+static void release_stream(struct tcp_reassembly *r, struct tcp_stream *stream) {
+  struct tcp_stream **link = &r->buckets[hash_key(&stream->key) & r->bucket_mask];
+  while (*link != stream) link = &(*link)->hash_next;
+  *link = stream->hash_next;
+
+  lru_remove(r, stream);
+  free_segments(r, stream);
+
+  stream->hash_next = r->free_streams;
+  r->free_streams = stream;
+}
+
+static struct tcp_stream *find_stream(struct tcp_reassembly *r,
+                                      const struct tcp_stream_key *key) {
+  struct tcp_stream *stream = r->buckets[hash_key(key) & r->bucket_mask];
+  while (stream != NULL && memcmp(&stream->key, key, sizeof(struct tcp_stream_key)) != 0) {
+    stream = stream->hash_next;
+  }
+  return stream;
+}
+
+static struct tcp_stream *new_stream(struct tcp_reassembly *r,
+                                     const struct tcp_stream_key *key) {
+  // With every stream in use, the least recently active one makes room.
+  if (r->free_streams == NULL) release_stream(r, r->lru_head);
+
+  struct tcp_stream *stream = r->free_streams;
+  r->free_streams = stream->hash_next;
+  memset(stream, 0, sizeof(struct tcp_stream));
+  stream->key = *key;
+
+  struct tcp_stream **bucket = &r->buckets[hash_key(key) & r->bucket_mask];
+  stream->hash_next = *bucket;
+  *bucket = stream;
+  lru_append(r, stream);
+  return stream;
+}
+
+/*
+  * Get a segment block, taking one from the buffers of the least recently
+  * active streams if the pool is empty.
+  * @return: The block, or NULL if none could be found.
+*/
+static struct tcp_segment *get_segment(struct tcp_reassembly *r,
+                                       struct tcp_stream *current) {
+  struct tcp_segment *segment = pool_get(&r->pool);
+  struct tcp_stream *victim = r->lru_head;
+  for (int i = 0; segment == NULL && victim != NULL && i < POOL_RECLAIM_SCAN; i++) {
+    if (victim != current && victim->segments != NULL) {
+      // The victim can never get this data back, so a match must not
+      // continue across the hole.
+      free_segments(r, victim);
+      victim->user_state = 0;
+      segment = pool_get(&r->pool);
+    }
+    victim = victim->lru_next;
+  }
+  return segment;
+}
+
+static void deliver(struct tcp_stream *stream, const u_char *data, int length,
+                    tcp_deliver_cb callback, void *user) {
+  callback(data, length, stream->next_seq - stream->isn, &stream->user_state, user);
+  stream->next_seq += length;
+}
+
+/* Deliver buffered segments that are no longer behind a gap. */
+static void drain(struct tcp_reassembly *r, struct tcp_stream *stream,
+                  tcp_deliver_cb callback, void *user) {
+  while (stream->segments != NULL && seq_diff(stream->segments->seq, stream->next_seq) <= 0) {
+    struct tcp_segment *segment = stream->segments;
+    stream->segments = segment->next;
+    stream->buffered -= segment->length;
+
+    // Skip whatever part of the segment overlaps data already delivered.
+    int32_t skip = seq_diff(stream->next_seq, segment->seq);
+    if (skip < segment->length) {
+      deliver(stream, segment->data + skip, segment->length - skip, callback, user);
+    }
+    pool_put(&r->pool, segment);
+  }
+}
+
+/*
+  * Copy out-of-order data into the stream's segment list.
+  * @return: 0 on success, 1 if some of the data had to be dropped
+*/
+static int buffer_data(struct tcp_reassembly *r, struct tcp_stream *stream,
+                       u_int32_t seq, const u_char *data, int length) {
+  while (length > 0) {
+    int chunk = length < TCP_SEGMENT_DATA_SIZE ? length : TCP_SEGMENT_DATA_SIZE;
+
+    struct tcp_segment **link = &stream->segments;
+    while (*link != NULL && seq_diff((*link)->seq, seq) < 0) link = &(*link)->next;
+
+    // A retransmission of a segment that is already buffered.
+    int duplicate = *link != NULL && (*link)->seq == seq && (*link)->length >= chunk;
+    if (!duplicate) {
+      struct tcp_segment *segment = get_segment(r, stream);
+      if (segment == NULL) return 1;
+      segment->seq = seq;
+      segment->length = (u_int16_t)chunk;
+      memcpy(segment->data, data, chunk);
+      segment->next = *link;
+      *link = segment;
+      stream->buffered += chunk;
+    }
+
+    seq += chunk;
+    data += chunk;
+    length -= chunk;
+  }
+  return 0;
+}
+
+/*
+  * Create a reassembler. All memory is allocated up front from the
+  * session: the stream table counts as aggregates, segment storage as
+  * buffers. It is released together with the session.
+  * @param memory: The capture session to allocate from.
+  * @param max_streams: The maximum number of streams tracked at once.
+  * @param segment_count: The number of segment blocks shared by all streams.
+  * @param stream_buffer_limit: Out-of-order bytes a stream may hold before
+  *   it gives up on the missing data and skips over the gap.
+  * @param idle_timeout: Seconds without traffic after which a stream is dropped.
+  * @return: The reassembler, or NULL if it doesn't fit in the session's budget.
+*/
+struct tcp_reassembly *tcp_reassembly_create(struct memory_session *memory,
+                                             int max_streams, int segment_count,
+                                             int stream_buffer_limit,
+                                             int idle_timeout) {
+  u_int32_t bucket_count = 1;
+  while (bucket_count < (u_int32_t)max_streams * 2) bucket_count <<= 1;
+
+  struct tcp_reassembly *r = session_memory_alloc(memory, MEMORY_AGGREGATES, sizeof(struct tcp_reassembly));
+  if (r == NULL) return NULL;
+  memset(r, 0, sizeof(struct tcp_reassembly));
+
+  r->streams = session_memory_alloc(memory, MEMORY_AGGREGATES, (size_t)max_streams * sizeof(struct tcp_stream));
+  r->buckets = session_memory_alloc(memory, MEMORY_AGGREGATES, bucket_count * sizeof(struct tcp_stream *));
+  if (r->streams == NULL || r->buckets == NULL || pool_init(&r->pool, memory, segment_count) != 0) {
+    return NULL;
+  }
+  memset(r->streams, 0, (size_t)max_streams * sizeof(struct tcp_stream));
+  memset(r->buckets, 0, bucket_count * sizeof(struct tcp_stream *));
+  r->bucket_mask = bucket_count - 1;
+  r->stream_buffer_limit = stream_buffer_limit;
+  r->idle_timeout = idle_timeout;
+
+  for (int i = max_streams - 1; i >= 0; i--) {
+    r->streams[i].hash_next = r->free_streams;
+    r->free_streams = &r->streams[i];
+  }
+  return r;
+}
+
+/*
+  * Feed one TCP segment to the reassembler. Any data that becomes
+  * contiguous is passed to the callback before this returns.
+  * @param key: The stream the segment belongs to.
+  * @param seq: The segment's sequence number.
+  * @param flags: The TCP flags (TCP_FLAG_*).
+  * @param payload: The segment payload.
+  * @param length: The payload length.
+  * @param now: The capture time, used for idle eviction.
+  * @return: 0 on success, 1 if data was dropped for lack of memory
+*/
+int tcp_reassembly_process(struct tcp_reassembly *reassembly,
+                           const struct tcp_stream_key *key,
+                           u_int32_t seq, u_int8_t flags,
+                           const u_char *payload, int length, time_t now,
+                           tcp_deliver_cb callback, void *user) {
+  struct tcp_reassembly *r = reassembly;
+
+  while (r->lru_head != NULL && now - r->lru_head->last_seen > r->idle_timeout) {
+    release_stream(r, r->lru_head);
+  }
+
+  struct tcp_stream *stream = find_stream(r, key);
+  if (stream == NULL) {
+    if (flags & TCP_FLAG_RST) return 0;
+    stream = new_stream(r, key);
+    // Streams picked up mid-connection start at the first segment seen.
+    stream->isn = stream->next_seq = (flags & TCP_FLAG_SYN) ? seq + 1 : seq;
+  } else {
+    lru_remove(r, stream);
+    lru_append(r, stream);
+
+    // A SYN with another sequence number means the addresses and ports
+    // were reused by a new connection, maybe after a FIN or RST we missed.
+    if ((flags & TCP_FLAG_SYN) && (stream->closed || seq + 1 != stream->isn)) {
+      free_segments(r, stream);
+      stream->isn = stream->next_seq = seq + 1;
+      stream->user_state = 0;
+      stream->closed = 0;
+    }
+  }
+  stream->last_seen = now;
+
+  if (flags & TCP_FLAG_RST) {
+    release_stream(r, stream);
+    return 0;
+  }
+  if (stream->closed) {
+    return 0; // retransmissions after the FIN
+  }
+  if (flags & TCP_FLAG_SYN) seq += 1; // SYN takes up one sequence number
+
+  int result = 0;
+  if (length > 0) {
+    int32_t ahead = seq_diff(seq, stream->next_seq);
+    if (ahead <= 0) {
+      if (-ahead < length) {
+        deliver(stream, payload - ahead, length + ahead, callback, user);
+        drain(r, stream, callback, user);
+      }
+    } else {
+      result = buffer_data(r, stream, seq, payload, length);
+      if (stream->buffered > r->stream_buffer_limit) {
+        // Skip the gap. The caller's state described the bytes before it.
+        stream->next_seq = stream->segments->seq;
+        stream->user_state = 0;
+        drain(r, stream, callback, user);
+      }
+    }
+  }
+
+  // The stream stays around until it goes idle, so a retransmitted FIN
+  // with data isn't taken for a new stream and delivered again.
+  if ((flags & TCP_FLAG_FIN) && stream->segments == NULL) {
+    stream->closed = 1;
+  }
+  return result;
+}
+
+/*
+  * Reset the per-stream caller state of every stream to 0.
+  * @param reassembly: The reassembler.
+*/
+void tcp_reassembly_reset_user_state(struct tcp_reassembly *reassembly) {
+  for (struct tcp_stream *s = reassembly->lru_head; s != NULL; s = s->lru_next) {
+    s->user_state = 0;
+  }
+}
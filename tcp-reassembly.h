@@ -0,0 +1,46 @@
+#ifndef TCP_REASSEMBLY_H
+#define TCP_REASSEMBLY_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "session-arena.h"
+
+#define TCP_FLAG_FIN 0x01
+#define TCP_FLAG_SYN 0x02
+#define TCP_FLAG_RST 0x04
+
+/* One direction of a TCP connection. Zero the whole struct before filling
+   it in, since it is hashed and compared byte by byte. IPv4 addresses use
+   the first 4 bytes of the address fields. */
+struct tcp_stream_key {
+  u_int8_t src_addr[16];
+  u_int8_t dest_addr[16];
+  u_int16_t src_port;
+  u_int16_t dest_port;
+  u_int8_t family; // 4 or 6
+};
+
+struct tcp_reassembly;
+
+/* Called with stream data in order, without gaps or duplicates.
+   stream_offset is the position of data[0] in the stream. user_state is
+   an int kept per stream for the caller, starting at 0. It is set back to
+   0 whenever the stream skips over data that was lost, so state is never
+   carried across a hole. data stays valid until the next call to
+   tcp_reassembly_process(). */
+typedef void (*tcp_deliver_cb)(const u_char *data, int length,
+                               u_int32_t stream_offset, int *user_state,
+                               void *user);
+
+struct tcp_reassembly *tcp_reassembly_create(struct memory_session *memory,
+                                             int max_streams, int segment_count,
+                                             int stream_buffer_limit,
+                                             int idle_timeout);
+int tcp_reassembly_process(struct tcp_reassembly *reassembly,
+                           const struct tcp_stream_key *key,
+                           u_int32_t seq, u_int8_t flags,
+                           const u_char *payload, int length, time_t now,
+                           tcp_deliver_cb callback, void *user);
+void tcp_reassembly_reset_user_state(struct tcp_reassembly *reassembly);
+
+#endif /* TCP_REASSEMBLY_H */
@@ -0,0 +1,567 @@
+/*
+ * Feeds hand-made frames through the packet handler and checks the stream
+ * data that comes out. Built and run by `make check`; needs no interface.
+ *
+ * The sniffer is included directly so its static state (the capture
+ * session and the reassembler) can be set up without opening pcap.
+ */
+#include "../packet-sniffer.c"
+
+#define MAX_SEGMENT 4096
+
+static char stream[16384];
+static int stream_length = 0;
+static int last_payload_length = 0;
+static int match_count = 0; // reported through on_payload_match()
+static int last_match_count = 0; // total passed to on_packet_captured()
+static u_int32_t last_match_offset = 0;
+static char matched[256]; // the reported patterns, space separated
+
+/* Where feed() sends from, and the capture time it puts on the frame. */
+static int feed_ipv6 = 0;
+static int feed_port = 8080;
+static time_t feed_time = 100;
+
+void on_packet_captured(char *src_mac, char *dest_mac, char *eth_type,
+                        char *src_ipv4, char *dest_ipv4,
+                        char *src_ipv6, char *dest_ipv6,
+                        int src_port, int dest_port,
+                        char *payload, int payload_length, int match_count) {
+  (void)src_mac; (void)dest_mac; (void)eth_type;
+  (void)src_ipv4; (void)dest_ipv4; (void)src_ipv6; (void)dest_ipv6;
+  (void)src_port; (void)dest_port;
+  last_payload_length = payload_length;
+  last_match_count = match_count;
+  if (payload_length > 0 && stream_length + payload_length <= (int)sizeof(stream)) {
+    memcpy(stream + stream_length, payload, payload_length);
+    stream_length += payload_length;
+  }
+}
+
+void on_payload_match(char *pattern, int pattern_length, unsigned int offset) {
+  size_t used = strlen(matched);
+  snprintf(matched + used, sizeof(matched) - used, "%.*s ", pattern_length, pattern);
+  match_count++;
+  last_match_offset = offset;
+}
+
+void on_interfaces_changed(void) {
+}
+
+/*
+  * Build a TCP segment from 10.0.0.1:feed_port to 10.0.0.2:50000 (or the
+  * same ports over IPv6) and hand it to the packet handler.
+  * @param trailer: Bytes appended after the IP packet, like Ethernet padding.
+*/
+static void feed_bytes(u_int32_t seq, u_int8_t flags, const char *data, int length, int trailer) {
+  static u_char frame[14 + 40 + 20 + MAX_SEGMENT + 64];
+  int ip_header = feed_ipv6 ? 40 : 20;
+  u_char *ip = frame + 14;
+  u_char *tcp = ip + ip_header;
+
+  memset(frame, 0, sizeof(frame));
+  frame[12] = feed_ipv6 ? 0x86 : 0x08;
+  frame[13] = feed_ipv6 ? 0xDD : 0x00;
+  if (feed_ipv6) {
+    ip[0] = 0x60;
+    ip[4] = (20 + length) >> 8;
+    ip[5] = (20 + length) & 0xFF;
+    ip[6] = 6;
+    ip[23] = 1;
+    ip[39] = 2;
+  } else {
+    ip[0] = 0x45;
+    ip[2] = (20 + 20 + length) >> 8;
+    ip[3] = (20 + 20 + length) & 0xFF;
+    ip[9] = 6;
+    ip[12] = 10; ip[15] = 1;
+    ip[16] = 10; ip[19] = 2;
+  }
+  tcp[0] = feed_port >> 8; tcp[1] = feed_port & 0xFF;
+  tcp[2] = 50000 >> 8; tcp[3] = 50000 & 0xFF;
+  tcp[4] = seq >> 24; tcp[5] = seq >> 16; tcp[6] = seq >> 8; tcp[7] = seq;
+  tcp[12] = 0x50;
+  tcp[13] = flags;
+  memcpy(tcp + 20, data, length);
+
+  int frame_length = 14 + ip_header + 20 + length;
+  memset(frame + frame_length, '.', trailer);
+  frame_length += trailer;
+
+  struct pcap_pkthdr header;
+  memset(&header, 0, sizeof(header));
+  header.caplen = header.len = frame_length;
+  header.ts.tv_sec = feed_time;
+  packet_capture_handler(NULL, &header, frame);
+}
+
+static void feed(u_int32_t seq, u_int8_t flags, const char *data) {
+  feed_bytes(seq, flags, data, (int)strlen(data), 0);
+}
+
+static int expect_stream(const char *name, const char *expected, int length) {
+  int failed = stream_length != length || memcmp(stream, expected, length) != 0;
+  if (failed) {
+    fprintf(stderr, "%s: expected \"%.*s\", got \"%.*s\"\n", name, length, expected, stream_length, stream);
+  }
+  stream_length = 0;
+  return failed;
+}
+
+static int expect(const char *name, const char *expected) {
+  return expect_stream(name, expected, (int)strlen(expected));
+}
+
+static int expect_matches(const char *name, int expected) {
+  int failed = match_count != expected;
+  if (failed) fprintf(stderr, "%s: expected %d matches, got %d\n", name, expected, match_count);
+  matched[0] = '\0';
+  match_count = 0;
+  return failed;
+}
+
+/* Like expect_matches(), but checks which patterns were reported, in order. */
+static int expect_matched(const char *name, const char *expected) {
+  int failed = strcmp(matched, expected) != 0;
+  if (failed) fprintf(stderr, "%s: expected matches \"%s\", got \"%s\"\n", name, expected, matched);
+  matched[0] = '\0';
+  match_count = 0;
+  return failed;
+}
+
+static void use_patterns(const char **patterns, int count) {
+  int lengths[32];
+  for (int i = 0; i < count; i++) lengths[i] = (int)strlen(patterns[i]);
+  set_payload_patterns(patterns, lengths, count);
+  update_active_matcher();
+}
+
+/* Swap in a small reassembler so limits are easy to reach. Its memory
+   stays in the session until the session is destroyed. */
+static void use_reassembly(int streams, int segments, int buffer_limit) {
+  reassembly = tcp_reassembly_create(&session, streams, segments, buffer_limit,
+                                     TCP_STREAM_IDLE_TIMEOUT);
+}
+
+static int check_padding(void) {
+  int failed = 0;
+
+  // A bare ACK is 54 bytes and gets padded to the 60 byte Ethernet minimum.
+  feed_bytes(999, TCP_FLAG_SYN, "", 0, 6);
+  feed_bytes(1000, 0x18, "GET ", 4, 2);
+  feed_bytes(1004, 0x10, "", 0, 6);
+  if (last_payload_length != 0) {
+    fprintf(stderr, "padded ACK: %d bytes of padding taken as payload\n", last_payload_length);
+    failed = 1;
+  }
+  feed(1004, 0x18, "/index.html");
+  failed |= expect("IPv4 padded ACK", "GET /index.html");
+
+  feed_ipv6 = 1;
+  feed_bytes(5000, 0x18, "abc", 3, 4);
+  feed_bytes(5003, 0x10, "", 0, 4);
+  feed(5003, 0x18, "def");
+  feed_ipv6 = 0;
+  failed |= expect("IPv6 trailer", "abcdef");
+  return failed;
+}
+
+static int check_gap(void) {
+  const char *patterns[] = { "PASSWORD" };
+  char data[3 * 1400];
+  int failed = 0;
+
+  // The bytes between the two halves never arrive, so once the buffer
+  // limit forces a skip, no match may span the hole.
+  use_reassembly(16, 64, 4096);
+  use_patterns(patterns, 1);
+  feed_port = 1001;
+  memset(data, 'y', sizeof(data));
+  memcpy(data, "WORD", 4);
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "xxxxPASS");
+  for (int i = 0; i < 3; i++) {
+    feed_bytes(500 + i * 1400, 0x18, data + i * 1400, 1400, 0);
+  }
+  failed |= expect_matches("match across a gap", 0);
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_connection_reuse(void) {
+  int failed = 0;
+
+  // The FIN of the first connection was missed; the new SYN starts over.
+  feed_port = 1004;
+  feed(1000, TCP_FLAG_SYN, "");
+  feed(1001, 0x18, "old");
+  feed(5000, TCP_FLAG_SYN, "");
+  feed(5001, 0x18, "new");
+  failed |= expect("port reuse after a missed FIN", "oldnew");
+
+  // A retransmitted FIN with data is not delivered a second time.
+  feed(5004, 0x18 | TCP_FLAG_FIN, "end");
+  feed(5004, 0x18 | TCP_FLAG_FIN, "end");
+  failed |= expect("retransmitted FIN", "end");
+
+  // After a FIN, a new connection on the same ports is followed again.
+  feed(9000, TCP_FLAG_SYN, "");
+  feed(9001, 0x18, "again");
+  failed |= expect("port reuse after a FIN", "again");
+  return failed;
+}
+
+static int check_shared_affixes(void) {
+  const char *patterns[] = { "he", "she", "his", "hers" };
+  int failed = 0;
+
+  // "she" ends inside "hers" and contains "he", so finding all three
+  // takes both the failure and the output links.
+  use_patterns(patterns, 4);
+  feed_port = 1005;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "ushers");
+  failed |= expect_matched("shared prefixes and suffixes", "she he hers ");
+  feed(7, 0x18, "hishe");
+  failed |= expect_matched("shared prefixes, second packet", "his she he ");
+  failed |= expect("shared prefixes and suffixes", "ushershishe");
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_duplicate_patterns(void) {
+  const char *patterns[] = { "abc", "", "abc" };
+  int failed = 0;
+
+  // The duplicate is reported once per occurrence, the empty one never.
+  use_patterns(patterns, 3);
+  feed_port = 1006;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "abcxabc");
+  failed |= expect_matched("duplicate and empty patterns", "abc abc ");
+  failed |= expect("duplicate and empty patterns", "abcxabc");
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_many_first_bytes(void) {
+  char storage[20][3];
+  const char *patterns[20];
+  int failed = 0;
+
+  // More distinct first bytes than the prefilter can hold, so the scan
+  // falls back to the first byte table.
+  for (int i = 0; i < 20; i++) {
+    snprintf(storage[i], sizeof(storage[i]), "%c!", 'A' + i);
+    patterns[i] = storage[i];
+  }
+  use_patterns(patterns, 20);
+  feed_port = 1007;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "xA!yT!zK!U!A");
+  failed |= expect_matched("more than 16 first bytes", "A! T! K! ");
+  failed |= expect("more than 16 first bytes", "xA!yT!zK!U!A");
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_hot_swap(void) {
+  const char *old_patterns[] = { "PASSWORD" };
+  const char *new_patterns[] = { "RD" };
+  int failed = 0;
+
+  // Swapping matchers mid-stream starts every stream over in the new
+  // one: the old partial match must neither complete nor leave a state
+  // the new matcher doesn't have.
+  use_patterns(old_patterns, 1);
+  feed_port = 1008;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "PASSWO");
+  use_patterns(new_patterns, 1);
+  feed(7, 0x18, "RDxx");
+  failed |= expect_matched("hot swap", "RD ");
+  failed |= expect("hot swap", "RDxx");
+  if (last_match_offset != 6) {
+    fprintf(stderr, "hot swap: expected the match at 6, got %u\n", last_match_offset);
+    failed = 1;
+  }
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_reorder(void) {
+  int failed = 0;
+
+  use_reassembly(16, 64, 64 * 1024);
+  feed_port = 2001;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(7, 0x18, "ccc");
+  feed(4, 0x18, "bbb");
+  failed |= expect("reversed segments, before the first", "");
+  feed(1, 0x18, "aaa");
+  failed |= expect("reversed segments", "aaabbbccc");
+  return failed;
+}
+
+static int check_overlap(void) {
+  int failed = 0;
+
+  use_reassembly(16, 64, 64 * 1024);
+  feed_port = 2002;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "abcdef");
+  feed(4, 0x18, "defghi");
+  feed(1, 0x18, "abc");
+  feed(7, 0x18, "ghi");
+  failed |= expect("overlapping and retransmitted segments", "abcdefghi");
+
+  // The same, with the overlapping segments buffered out of order, one
+  // of them twice.
+  feed(16, 0x18, "pqr");
+  feed(14, 0x18, "nopq");
+  feed(16, 0x18, "pqr");
+  feed(10, 0x18, "jklm");
+  failed |= expect("overlapping buffered segments", "jklmnopqr");
+  return failed;
+}
+
+static int check_buffer_limit(void) {
+  char data[3 * 1400];
+  char expected[3 + sizeof(data)];
+  int failed = 0;
+
+  // Bytes 4..99 never arrive. Once more than the limit is buffered, the
+  // stream gives up on them and carries on after the gap.
+  use_reassembly(16, 64, 4096);
+  feed_port = 2003;
+  memset(data, 'z', sizeof(data));
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "abc");
+  for (int i = 0; i < 3; i++) {
+    feed_bytes(100 + i * 1400, 0x18, data + i * 1400, 1400, 0);
+  }
+  memcpy(expected, "abc", 3);
+  memcpy(expected + 3, data, sizeof(data));
+  failed |= expect_stream("buffer limit", expected, sizeof(expected));
+  return failed;
+}
+
+static int check_idle_eviction(void) {
+  int failed = 0;
+
+  use_reassembly(16, 64, 64 * 1024);
+  feed_port = 2004;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "abc");
+  failed |= expect("idle stream", "abc");
+
+  // Traffic on another stream after the timeout drops the idle one, so
+  // its next segment starts a new stream instead of waiting for 4..6.
+  feed_time += TCP_STREAM_IDLE_TIMEOUT + 1;
+  feed_port = 2005;
+  feed(0, TCP_FLAG_SYN, "");
+  feed_port = 2004;
+  feed(7, 0x18, "ghi");
+  feed(4, 0x18, "def");
+  failed |= expect("idle eviction", "ghi");
+  return failed;
+}
+
+static int check_lru_eviction(void) {
+  int failed = 0;
+
+  // With room for 3 streams, a 4th one replaces the least recently
+  // active, which then starts over when it shows up again.
+  use_reassembly(3, 64, 64 * 1024);
+  for (feed_port = 3001; feed_port <= 3004; feed_port++) {
+    feed(1, 0x18, "a");
+  }
+  feed_port = 3001;
+  feed(3, 0x18, "c");
+  feed_port = 3004;
+  feed(3, 0x18, "c");
+  failed |= expect("LRU eviction", "aaaac");
+  return failed;
+}
+
+static int check_pool_reclaim(void) {
+  int failed = 0;
+
+  // Four segment blocks in all. Stream B needs three while A holds two,
+  // so B takes A's, the least recently active.
+  use_reassembly(16, 4, 64 * 1024);
+  feed_port = 4001;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "x");
+  feed(10, 0x18, "A1");
+  feed(12, 0x18, "A2");
+  feed_port = 4002;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(10, 0x18, "B1");
+  feed(12, 0x18, "B2");
+  feed(14, 0x18, "B3");
+  feed(1, 0x18, "bbbbbbbbb");
+  failed |= expect("pool reclaim, taker", "xbbbbbbbbbB1B2B3");
+
+  // A's buffered data is gone for good; only the gap itself comes out.
+  feed_port = 4001;
+  feed(2, 0x18, "yyyyyyyy");
+  failed |= expect("pool reclaim, victim", "yyyyyyyy");
+  return failed;
+}
+
+static int check_matched_payload(void) {
+  const char *patterns[] = { "bc" };
+  int failed = 0;
+
+  // Packets without a match carry no payload. One that completes a match
+  // carries everything it made available, joined from the capture buffer
+  // and the buffered segment.
+  use_patterns(patterns, 1);
+  feed_port = 1002;
+  feed(0, TCP_FLAG_SYN, "");
+  feed(1, 0x18, "xx");
+  feed(5, 0x18, "cy");
+  failed |= expect("unmatched packets", "");
+  feed(3, 0x18, "zb");
+  failed |= expect("matched packet", "zbcy");
+  failed |= expect_matches("matched packet", 1);
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_match_cap(void) {
+  const char *patterns[] = { "a" };
+  char data[1000];
+  int failed = 0;
+
+  // Every byte matches, but only the first few matches are reported.
+  use_patterns(patterns, 1);
+  feed_port = 1003;
+  memset(data, 'a', sizeof(data));
+  feed_bytes(1, 0x18, data, sizeof(data), 0);
+  if (last_match_count != (int)sizeof(data)) {
+    fprintf(stderr, "match cap: expected a total of %d matches, got %d\n", (int)sizeof(data), last_match_count);
+    failed = 1;
+  }
+  failed |= expect_matches("match cap", PAYLOAD_MAX_REPORTED_MATCHES);
+  stream_length = 0;
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_offsets(void) {
+  const char *patterns[] = { "index" };
+  int failed = 0;
+
+  // Offsets past 2 GiB must come out unsigned, also for a match that
+  // started in the previous block.
+  use_patterns(patterns, 1);
+  int state = 0;
+  stream_data((const u_char *)"/ind", 4, 0xC0000000u, &state, &view);
+  stream_data((const u_char *)"ex", 2, 0xC0000004u, &state, &view);
+  if (last_match_offset != 0xC0000001u) {
+    fprintf(stderr, "match offset: expected %u, got %u\n", 0xC0000001u, last_match_offset);
+    failed = 1;
+  }
+  match_count = 0;
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_running_budget(void) {
+  static char long_pattern[1000];
+  const char *patterns[] = { long_pattern };
+  int length = sizeof(long_pattern);
+  int failed = 0;
+
+  // During a capture a new matcher has to fit in what the session has
+  // left, even though it is far below the whole budget.
+  memset(long_pattern, 'x', sizeof(long_pattern));
+  size_t left = session_memory_available(&session);
+  size_t taken = left - 100 * 1024;
+  session_memory_charge(&session, MEMORY_AGGREGATES, taken);
+  if (set_payload_patterns(patterns, &length, 1) == 0) {
+    fprintf(stderr, "running capture: accepted a %zu byte matcher with 100 KB left\n",
+            payload_matcher_memory_size(&length, 1));
+    failed = 1;
+  }
+  session_memory_uncharge(&session, MEMORY_AGGREGATES, taken);
+  if (set_payload_patterns(patterns, &length, 1) != 0) {
+    fprintf(stderr, "running capture: refused a matcher that fits\n");
+    failed = 1;
+  }
+  use_patterns(NULL, 0);
+  return failed;
+}
+
+static int check_small_budget(void) {
+  int failed = 0;
+  set_memory_budget(200 * 1024);
+
+  // A pattern set whose automaton is bigger than the budget is refused
+  // before it is built.
+  static char long_pattern[1000];
+  memset(long_pattern, 'x', sizeof(long_pattern));
+  const char *long_patterns[] = { long_pattern };
+  int long_length = sizeof(long_pattern);
+  if (set_payload_patterns(long_patterns, &long_length, 1) == 0) {
+    fprintf(stderr, "oversized patterns: accepted a %zu byte matcher with a 200 KB budget\n",
+            payload_matcher_memory_size(&long_length, 1));
+    failed = 1;
+  }
+
+  // When even the smallest reassembly tables don't fit, only the payload
+  // view may stay reserved.
+  setup_capture_session();
+  struct memory_usage usage;
+  session_memory_usage(&session, &usage);
+  if (reassembly != NULL || view.data == NULL || usage.reserved[MEMORY_AGGREGATES] != 0 ||
+      usage.reserved[MEMORY_BUFFERS] >= 2 * PAYLOAD_VIEW_SIZE) {
+    fprintf(stderr, "small budget: %zu + %zu bytes reserved after giving up on reassembly\n",
+            usage.reserved[MEMORY_AGGREGATES], usage.reserved[MEMORY_BUFFERS]);
+    failed = 1;
+  }
+  reassembly = NULL;
+  view.data = NULL;
+  session_memory_destroy(&session);
+  set_memory_budget(DEFAULT_MEMORY_BUDGET);
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+
+  setup_capture_session();
+  if (reassembly == NULL || view.data == NULL) {
+    fprintf(stderr, "Couldn't set up the capture session\n");
+    return 1;
+  }
+
+  failed |= check_padding();
+  failed |= check_matched_payload();
+  failed |= check_offsets();
+  failed |= check_match_cap();
+  failed |= check_shared_affixes();
+  failed |= check_duplicate_patterns();
+  failed |= check_many_first_bytes();
+  failed |= check_hot_swap();
+  failed |= check_reorder();
+  failed |= check_overlap();
+  failed |= check_buffer_limit();
+  failed |= check_idle_eviction();
+  failed |= check_lru_eviction();
+  failed |= check_pool_reclaim();
+  failed |= check_gap();
+  failed |= check_connection_reuse();
+  failed |= check_running_budget();
+
+  reassembly = NULL;
+  view.data = NULL;
+  session_memory_destroy(&session);
+
+  failed |= check_small_budget();
+
+  if (!failed) printf("packet-sniffer-check: all checks passed\n");
+  return failed;
+}
@@ -4,6 +4,8 @@
 #include <string.h>
 #include <sys/types.h>
 #include "wifi-scanner.h"
+#include "session-arena.h"
+#include "interface-inventory.h"
 
 struct ieee80211_radiotap_header {
   u_int8_t it_version; // should be 0
@@ -20,17 +22,23 @@ struct network_info {
   char bssid[19]; // BSSID (MAC address) in string format "xx:xx:xx:xx:xx:xx"
 };
 
+/* Owns all memory of the running capture; released in bulk when it stops. */
+static struct memory_session session;
+
 /*
 Given a raw beacon frame and its length, extract the network information.
+The result lives in the session's parser scratch, which is reset after every packet.
 @param packet: The raw packet data containing the beacon frame.
 @param length: The length of the packet data.
-@return: A pointer to a network_info struct containing the extracted information, or NULL if the packet is not a beacon frame.
+@return: A pointer to a network_info struct containing the extracted information, or NULL if the packet is not a beacon frame or the memory budget is exhausted.
 */
 struct network_info* get_network_info(const u_char* packet, int length) {
-  (void)length; // Unused parameter
   // Extract radiotap header
   struct ieee80211_radiotap_header *rtap = (struct ieee80211_radiotap_header *)packet;
-  struct network_info* info = malloc(sizeof(struct network_info));
+  struct network_info* info = session_memory_alloc(&session, MEMORY_PARSER, sizeof(struct network_info));
+  if (info == NULL) {
+    return NULL;
+  }
   memset(info, 0, sizeof(struct network_info));
 
   int offset = 8; // End of first bitmap
@@ -86,10 +94,11 @@ struct network_info* get_network_info(const u_char* packet, int length) {
 
     switch(tag_number) {
       case 0: // SSID
-        for (int i = 0; i < tag_length; i++) {
+        // Clamp to the buffer; parser scratch sits next to other allocations.
+        for (int i = 0; i < tag_length && i < 32; i++) {
           info->ssid[i] = packet[offset + i];
         }
-        info->ssid[tag_length] = '\0';
+        info->ssid[tag_length < 32 ? tag_length : 32] = '\0';
         break;
       case 3: // DS Parameter Set (Channel)
         info->channel = (u_int8_t)packet[offset];
@@ -103,62 +112,16 @@ struct network_info* get_network_info(const u_char* packet, int length) {
   return info;
 }
 
-/*
-  * Free the memory allocated for a network_info struct.
-  * @param info: The pointer to the network_info struct to free.
-*/
-void free_network_info(struct network_info* info) {
-  free(info);
-}
-
 
 /*
-  * Get a list of network interfaces that support monitor mode.
+  * Get a list of network interfaces that support monitor mode. The list
+  * comes from the interface inventory, so no devices are opened here.
   * @param interfaces: A pointer to an array of strings to store the interface names.
   * @param count: A pointer to an integer to store the number of interfaces found.
   * @return: 0 on success, 2 on error
 */
 int get_monitor_interfaces(char **interfaces[], int *count) {
-  char errbuf[PCAP_ERRBUF_SIZE];
-  pcap_if_t *devs;
-
-  if (pcap_findalldevs(&devs, errbuf) != 0){
-    fprintf(stderr, "Error getting interfaces: %s\n", errbuf);
-    return (2);
-  }
-  if (devs == NULL){
-    *count = 0;
-    return (0);
-  }
-
-  *count = 0;
-  for (pcap_if_t *d = devs; d != NULL; d = d->next) {
-      pcap_t *dev = pcap_create(d->name, errbuf);
-      if (dev == NULL) {
-          continue;
-      }
-      if (pcap_can_set_rfmon(dev) == 1)
-        (*count)++;
-  }
-
-  *interfaces = (char **)malloc((*count) * sizeof(char *));
-
-  int i = 0; pcap_if_t *d = devs;
-  while (d != NULL && i < *count) {
-    pcap_t *dev = pcap_create(d->name, errbuf);
-    if (dev == NULL) {
-        continue;
-    }
-    if (pcap_can_set_rfmon(dev) == 1){
-      (*interfaces)[i] = (char *)malloc((strlen(d->name) + 1) * sizeof(char));
-      strcpy((*interfaces)[i], d->name);
-      i++;
-    } 
-    d = d->next;
-  }
-
-  pcap_freealldevs(devs);
-  return 0;
+  return interface_inventory_names(interfaces, count, 1);
 }
 
 /*
@@ -186,8 +149,19 @@ void packet_handler(u_char *user, const struct pcap_pkthdr *header, const u_char
     on_network_found(info->ssid, info->bssid,
                      info->channel, info->frequency,
                      info->signal_strength);
-    free(info);
   }
+  session_memory_reset(&session, MEMORY_PARSER);
+}
+
+/*
+  * Get the memory use of the running beacon capture, per subsystem.
+  * Safe to call from any thread.
+  * @param usage: Where to store the usage.
+  * @return: 0 on success
+*/
+int get_capture_memory_usage(struct memory_usage *usage) {
+  session_memory_usage(&session, usage);
+  return 0;
 }
 
 /*
@@ -241,6 +215,7 @@ int start_capture(const char *interface_name) {
     return 1;
   }
 
+  session_memory_init(&session, get_memory_budget());
   active_handle = handle;
 
   /* Blocks until pcap_breakloop() is called or an error occurs. */
@@ -250,6 +225,7 @@ int start_capture(const char *interface_name) {
   }
 
   active_handle = NULL;
+  session_memory_destroy(&session);
   pcap_freecode(&fp);
   pcap_close(handle);
   return (result == PCAP_ERROR) ? 1 : 0;
@@ -277,6 +253,9 @@ void on_network_found(char *ssid, char *bssid,
          ssid, bssid, channel, frequency, signal_strength);
 }
 
+void on_interfaces_changed(void) {
+}
+
 int main() {
   char **interfaces;
   int count;
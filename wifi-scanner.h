@@ -1,10 +1,13 @@
 #ifndef WIFI_SCANNER_H
 #define WIFI_SCANNER_H
 
+#include "session-arena.h"
+
 int get_monitor_interfaces(char **interfaces[], int *count);
 int free_monitor_interfaces(char **interfaces, int count);
 int start_capture(const char *interface_name);
 int stop_capture(void);
+int get_capture_memory_usage(struct memory_usage *usage);
 
 /* Callback implemented in Go (via //export) when built with cgo,
    or in C for standalone builds. Called for every beacon frame. */